@@ -0,0 +1,54 @@
+//
+//  bench.h
+//
+//  Timing helpers shared by the micro-benchmarks.
+//
+
+#ifndef CPPHTTPLIB_BENCH_H
+#define CPPHTTPLIB_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+
+namespace bench {
+
+// Keeps the compiler from dropping a result that is never used.
+template <typename T> inline void keep(const T &value) {
+#ifdef __GNUC__
+  asm volatile("" : : "g"(&value) : "memory");
+#else
+  static const void *volatile sink;
+  sink = &value;
+#endif
+}
+
+// Runs `fn` `count` times, five rounds, and returns the best round in
+// nanoseconds per call.
+template <typename Fn> inline double measure(size_t count, Fn fn) {
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+      fn();
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(
+                       std::chrono::steady_clock::now() - start)
+                       .count() /
+                   static_cast<double>(count);
+    if (round == 0 || elapsed < best) { best = elapsed; }
+  }
+  return best;
+}
+
+inline void report(const char *name, double before, double after) {
+  printf("%-28s %9.1f ns %9.1f ns %7.1fx\n", name, before, after,
+         before / after);
+}
+
+inline void header() {
+  printf("%-28s %12s %12s %8s\n", "", "before", "after", "speedup");
+}
+
+} // namespace bench
+
+#endif // CPPHTTPLIB_BENCH_H
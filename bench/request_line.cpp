@@ -0,0 +1,55 @@
+//
+//  request_line.cpp
+//
+//  Splits request lines into method, target, path, query and version
+//  strings with detail::parse_request_line, against the std::regex match
+//  Server::parse_request_line used before.
+//
+
+#include "bench.h"
+#include "test/reference.h"
+#include <httplib.h>
+
+using namespace httplib;
+
+namespace {
+
+const size_t kCount = 200000;
+
+bool parse(const char *s, reference::RequestLine &f) {
+  detail::RequestLine line;
+  if (!detail::parse_request_line(s, s + strlen(s), line)) { return false; }
+  f.method.assign(line.method.first, line.method.second);
+  f.target.assign(line.target.first, line.target.second);
+  f.path.assign(line.path.first, line.path.second);
+  f.query.assign(line.query.first, line.query.second);
+  f.version.assign(line.version.first, line.version.second);
+  return true;
+}
+
+void run(const char *name, const char *s) {
+  reference::RequestLine f;
+  auto before = bench::measure(kCount, [&] {
+    auto ok = reference::parse_request_line(s, f);
+    bench::keep(ok);
+  });
+  auto after = bench::measure(kCount, [&] {
+    auto ok = parse(s, f);
+    bench::keep(ok);
+  });
+  bench::report(name, before, after);
+}
+
+} // namespace
+
+int main() {
+  bench::header();
+  run("GET /", "GET / HTTP/1.1\r\n");
+  run("GET with query",
+      "GET /api/users/123/files?sort=name&limit=10 HTTP/1.1\r\n");
+  run("POST, long path",
+      "POST /static/assets/javascripts/application-4f2c1b9e8a7d6c5b.js "
+      "HTTP/1.1\r\n");
+  run("rejected", "GET / HTTP/2.0\r\n");
+  return 0;
+}
@@ -0,0 +1,120 @@
+//
+//  response_head.cpp
+//
+//  Serializes the status line, the Date field and the header fields of a
+//  typical response, the way write_response does, against the snprintf based
+//  code it replaced. That code had no Date field; it is formatted per
+//  response with strftime here, which is what the cached field avoids.
+//
+
+#include "bench.h"
+#include <httplib.h>
+
+using namespace httplib;
+
+namespace {
+
+const size_t kCount = 1000000;
+
+void old_status_line(std::string &out, int status) {
+  char buf[128];
+  auto n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n", status,
+                    detail::status_message(status));
+  out.append(buf, static_cast<size_t>(n));
+}
+
+void old_date_field(std::string &out) {
+  char buf[64];
+  auto t = time(nullptr);
+  struct tm tm;
+#ifdef _WIN32
+  gmtime_s(&tm, &t);
+#else
+  gmtime_r(&t, &tm);
+#endif
+  auto n = strftime(buf, sizeof(buf), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n",
+                    &tm);
+  out.append(buf, n);
+}
+
+void old_headers(std::string &out, const Response &res) {
+  char buf[2048];
+  for (const auto &x : res.headers) {
+    auto n = snprintf(buf, sizeof(buf), "%s: %s\r\n", x.first.c_str(),
+                      x.second.c_str());
+    out.append(buf, static_cast<size_t>(n));
+  }
+  out.append("\r\n");
+}
+
+} // namespace
+
+int main() {
+  Response res;
+  res.status = 200;
+  res.set_header("Content-Type", "text/plain");
+  res.set_header("Content-Length", "12");
+  res.set_header("Connection", "Keep-Alive");
+
+  // The server's accept loops publish the current second.
+  detail::tick_date_clock();
+
+  std::string out;
+  out.reserve(1024);
+
+  bench::header();
+
+  auto before = bench::measure(kCount, [&] {
+    out.clear();
+    old_status_line(out, res.status);
+    bench::keep(out);
+  });
+  auto after = bench::measure(kCount, [&] {
+    out.clear();
+    detail::append_status_line(out, res.status);
+    bench::keep(out);
+  });
+  bench::report("status line", before, after);
+
+  before = bench::measure(kCount, [&] {
+    out.clear();
+    old_date_field(out);
+    bench::keep(out);
+  });
+  after = bench::measure(kCount, [&] {
+    out.clear();
+    detail::append_date_field(out);
+    bench::keep(out);
+  });
+  bench::report("Date field", before, after);
+
+  before = bench::measure(kCount, [&] {
+    out.clear();
+    old_headers(out, res);
+    bench::keep(out);
+  });
+  after = bench::measure(kCount, [&] {
+    out.clear();
+    detail::append_headers(out, res);
+    bench::keep(out);
+  });
+  bench::report("header fields (3)", before, after);
+
+  before = bench::measure(kCount, [&] {
+    out.clear();
+    old_status_line(out, res.status);
+    old_date_field(out);
+    old_headers(out, res);
+    bench::keep(out);
+  });
+  after = bench::measure(kCount, [&] {
+    out.clear();
+    detail::append_status_line(out, res.status);
+    detail::append_date_field(out);
+    detail::append_headers(out, res);
+    bench::keep(out);
+  });
+  bench::report("response head", before, after);
+
+  return 0;
+}
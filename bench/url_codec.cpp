@@ -0,0 +1,60 @@
+//
+//  url_codec.cpp
+//
+//  Encodes and decodes URL paths and query values with the table driven
+//  detail::encode_url and detail::decode_url, against the character by
+//  character versions they replaced.
+//
+
+#include "bench.h"
+#include "test/reference.h"
+#include <httplib.h>
+
+using namespace httplib;
+
+namespace {
+
+const size_t kCount = 200000;
+
+void run_encode(const char *name, const std::string &s) {
+  std::string out;
+  auto before = bench::measure(kCount, [&] {
+    out = reference::encode_url(s);
+    bench::keep(out);
+  });
+  auto after = bench::measure(kCount, [&] {
+    out = detail::encode_url(s);
+    bench::keep(out);
+  });
+  bench::report(name, before, after);
+}
+
+void run_decode(const char *name, const std::string &s) {
+  std::string out;
+  auto before = bench::measure(kCount, [&] {
+    out = reference::decode_url(s);
+    bench::keep(out);
+  });
+  auto after = bench::measure(kCount, [&] {
+    detail::decode_url(s.data(), s.data() + s.size(), out);
+    bench::keep(out);
+  });
+  bench::report(name, before, after);
+}
+
+} // namespace
+
+int main() {
+  bench::header();
+  run_encode("encode, plain path",
+             "/static/assets/javascripts/application-4f2c1b9e8a7d6c5b.js");
+  run_encode("encode, spaces and UTF-8",
+             "/files/My Documents/\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e "
+             "notes, draft.txt");
+  run_decode("decode, plain path",
+             "/static/assets/javascripts/application-4f2c1b9e8a7d6c5b.js");
+  run_decode("decode, query value",
+             "name%3Dvalue+with+spaces%2C%20and%20%E6%97%A5%E6%9C%AC%E8%AA%9E");
+  run_decode("decode, invalid escapes", "/a%zz/b%4/100%/c%u12");
+  return 0;
+}
@@ -43,6 +43,10 @@
 #define strcasecmp _stricmp
 #endif // strcasecmp
 
+#ifdef _MSC_VER
+typedef SSIZE_T ssize_t;
+#endif // _MSC_VER
+
 typedef SOCKET socket_t;
 #else
 #include <arpa/inet.h>
@@ -50,20 +54,43 @@ typedef SOCKET socket_t;
 #include <netdb.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <poll.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#define CPPHTTPLIB_EPOLL_SUPPORT
+#define CPPHTTPLIB_SENDFILE_SUPPORT
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#endif
+
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 typedef int socket_t;
 #define INVALID_SOCKET (-1)
 #endif //_WIN32
 
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
 #include <fcntl.h>
 #include <fstream>
 #include <functional>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -71,6 +98,8 @@ typedef int socket_t;
 #include <string>
 #include <sys/stat.h>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 #include <openssl/err.h>
@@ -88,6 +117,18 @@ inline const unsigned char *ASN1_STRING_get0_data(const ASN1_STRING *asn1) {
 #include <zlib.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPPHTTPLIB_SSE2_SUPPORT
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 /*
  * Configuration
  */
@@ -96,50 +137,596 @@ inline const unsigned char *ASN1_STRING_get0_data(const ASN1_STRING *asn1) {
 #define CPPHTTPLIB_KEEPALIVE_MAX_COUNT 5
 #define CPPHTTPLIB_READ_TIMEOUT_SECOND 5
 #define CPPHTTPLIB_READ_TIMEOUT_USECOND 0
+#define CPPHTTPLIB_WRITE_TIMEOUT_SECOND 5
+#define CPPHTTPLIB_WRITE_TIMEOUT_USECOND 0
+#define CPPHTTPLIB_TIMER_WHEEL_TICK_MSEC 100
 #define CPPHTTPLIB_REQUEST_URI_MAX_LENGTH 8192
 #define CPPHTTPLIB_PAYLOAD_MAX_LENGTH (std::numeric_limits<size_t>::max)()
+#define CPPHTTPLIB_REUSED_BODY_MAX_CAPACITY size_t(65536u)
+#define CPPHTTPLIB_FILE_CACHE_TTL_SECOND 1
 #define CPPHTTPLIB_RECV_BUFSIZ size_t(4096u)
+#define CPPHTTPLIB_SEND_BUFSIZ size_t(65536u)
+#define CPPHTTPLIB_LISTEN_BACKLOG SOMAXCONN
+#define CPPHTTPLIB_EPOLL_MAX_EVENTS 64
+#define CPPHTTPLIB_IO_URING_ENTRIES 8
+#define CPPHTTPLIB_THREAD_POOL_COUNT                                           \
+  ((std::max)(8u, std::thread::hardware_concurrency() > 0                      \
+                      ? std::thread::hardware_concurrency() - 1                \
+                      : 0))
+#define CPPHTTPLIB_THREAD_POOL_QUEUE_MAX 1024
 
 namespace httplib {
 
+// Standard header fields the library consults while framing messages. Fields
+// with these names are resolved once when they are added to `Headers`, so
+// finding them again is a field read.
+enum class HeaderId {
+  Accept = 0,
+  AcceptEncoding,
+  Connection,
+  ContentEncoding,
+  ContentLength,
+  ContentType,
+  Date,
+  ETag,
+  Host,
+  IfModifiedSince,
+  IfNoneMatch,
+  LastModified,
+  Location,
+  Range,
+  TransferEncoding,
+  UserAgent,
+  Unknown
+};
+
+// Request methods the server tells apart without comparing strings. Any
+// other method is `MethodId::Unknown` and is known by its name only.
+enum class MethodId {
+  Get = 0,
+  Head,
+  Post,
+  Put,
+  Patch,
+  Delete,
+  Options,
+  Unknown
+};
+
 namespace detail {
 
-struct ci {
-  bool operator()(const std::string &s1, const std::string &s2) const {
-    return std::lexicographical_compare(
-        s1.begin(), s1.end(), s2.begin(), s2.end(),
-        [](char c1, char c2) { return ::tolower(c1) < ::tolower(c2); });
+inline char to_lower(char c) { return ('A' <= c && c <= 'Z') ? c + 32 : c; }
+
+struct KnownHeader {
+  const char *name;
+  size_t size;
+};
+
+// Indexed by `HeaderId`.
+inline const KnownHeader *known_headers() {
+  static const KnownHeader table[] = {
+      {"Accept", 6},
+      {"Accept-Encoding", 15},
+      {"Connection", 10},
+      {"Content-Encoding", 16},
+      {"Content-Length", 14},
+      {"Content-Type", 12},
+      {"Date", 4},
+      {"ETag", 4},
+      {"Host", 4},
+      {"If-Modified-Since", 17},
+      {"If-None-Match", 13},
+      {"Last-Modified", 13},
+      {"Location", 8},
+      {"Range", 5},
+      {"Transfer-Encoding", 17},
+      {"User-Agent", 10},
+  };
+  return table;
+}
+
+inline const char *header_name(HeaderId id) {
+  return known_headers()[static_cast<size_t>(id)].name;
+}
+
+inline HeaderId header_id(const char *s, size_t n) {
+  const auto table = known_headers();
+  for (size_t i = 0; i < static_cast<size_t>(HeaderId::Unknown); i++) {
+    if (table[i].size != n || to_lower(table[i].name[0]) != to_lower(s[0])) {
+      continue;
+    }
+    size_t j = 1;
+    while (j < n && to_lower(table[i].name[j]) == to_lower(s[j])) {
+      j++;
+    }
+    if (j == n) { return static_cast<HeaderId>(i); }
+  }
+  return HeaderId::Unknown;
+}
+
+// FNV-1a over the lowercased name, so equal names in any case hash alike.
+inline uint32_t header_name_hash(const char *s, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ static_cast<unsigned char>(to_lower(s[i]))) * 16777619u;
+  }
+  return h;
+}
+
+inline bool header_name_equal(const std::string &a, const char *b, size_t n) {
+  if (a.size() != n) { return false; }
+  for (size_t i = 0; i < n; i++) {
+    if (to_lower(a[i]) != to_lower(b[i])) { return false; }
+  }
+  return true;
+}
+
+// Socket wait timeout, split into seconds and microseconds like the
+// configuration macros. `none()` is a wait without a limit.
+struct Timeout {
+  Timeout() : Timeout(0, 0) {}
+  Timeout(time_t sec, time_t usec) : sec(sec), usec(usec), unlimited(false) {}
+
+  static Timeout none() {
+    Timeout timeout;
+    timeout.unlimited = true;
+    return timeout;
+  }
+
+  time_t sec;
+  time_t usec;
+  bool unlimited;
+
+  // Rounded up to the next millisecond. Not meaningful when `unlimited`.
+  std::chrono::milliseconds duration() const {
+    return std::chrono::milliseconds(static_cast<int64_t>(sec) * 1000 +
+                                     (static_cast<int64_t>(usec) + 999) / 1000);
+  }
+
+  // The timeout as poll takes it: -1 without a limit, and clamped to `int`.
+  int poll_milliseconds() const {
+    if (unlimited) { return -1; }
+    auto ms = duration().count();
+    return static_cast<int>(std::min<int64_t>(
+        std::max<int64_t>(ms, 0), std::numeric_limits<int>::max()));
   }
+
+  bool is_zero() const { return !unlimited && sec == 0 && usec == 0; }
+};
+
+// Read-ahead buffer of a stream. Bytes [pos, end) of `data` are unread.
+struct ReadBuffer {
+  std::vector<char> data;
+  size_t pos = 0;
+  size_t end = 0;
+
+  bool empty() const { return pos == end; }
 };
 
+// What a server connection is waiting for. Each stage has its own deadline.
+enum class Stage { None = 0, Idle, Handshake, Header, Body, Write };
+
+// Per stage deadlines of a server connection. The body and write deadlines
+// are inactivity timeouts: they are extended as long as bytes keep moving.
+// A zero timeout disables the deadline.
+struct StageTimeouts {
+  Timeout keep_alive;
+  Timeout handshake;
+  Timeout header;
+  Timeout body;
+  Timeout write;
+};
+
+struct Connection;
+struct File;
+class FileCache;
+class TimerWheel;
+class stream_line_reader;
+
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+class IoUring;
+#endif
+
 } // namespace detail
 
 enum class HttpVersion { v1_0 = 0, v1_1 };
 
-typedef std::multimap<std::string, std::string, detail::ci> Headers;
+// How `Server` handles accepted sockets. Requests are always served on a
+// worker of a bounded pool. `ThreadPool` parks idle keep-alive connections on
+// a single event loop thread, `Epoll` spreads them over several; event loops
+// are only available on Linux and both modes fall back to a worker per
+// connection elsewhere.
+enum class ServerMode { ThreadPool = 0, Epoll };
+
+// What the accept loop does when the worker pool queue is full.
+enum class QueueFullPolicy { Block = 0, Reject };
+
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+// Process wide io_uring counters. `syscalls_saved` counts the `select` calls
+// that a ring operation with a linked timeout made unnecessary.
+struct IoUringStats {
+  uint64_t operations = 0;
+  uint64_t syscalls = 0;
+  uint64_t syscalls_saved = 0;
+};
+
+IoUringStats get_io_uring_stats();
+#endif
+
+// Process wide counters of the per connection request storage (see
+// `Server::set_reuse_request_storage`). `recycled` counts requests parsed into
+// storage left over from an earlier request on the same connection, and
+// `released` the bodies that were too large to keep. `minor_faults` is
+// sampled from getrusage when the stats are read.
+struct RequestStorageStats {
+  uint64_t requests = 0;
+  uint64_t recycled = 0;
+  uint64_t released = 0;
+  uint64_t minor_faults = 0;
+};
+
+RequestStorageStats get_request_storage_stats();
+
+// Header fields in arrival order. Names compare case-insensitively through a
+// precomputed hash, and the first 16 fields live inside the object itself,
+// so typical requests look headers up without allocating or chasing nodes.
+// The first field of each `HeaderId` is also remembered in a fixed slot.
+class Headers {
+public:
+  typedef std::pair<std::string, std::string> value_type;
+  typedef value_type *iterator;
+  typedef const value_type *const_iterator;
+
+  Headers() {}
+  Headers(std::initializer_list<value_type> fields) {
+    for (const auto &x : fields) {
+      insert(x);
+    }
+  }
+
+  Headers(const Headers &) = default;
+  Headers &operator=(const Headers &) = default;
+
+  Headers(Headers &&other) { *this = std::move(other); }
+  Headers &operator=(Headers &&other) {
+    if (this != &other) {
+      for (size_t i = 0; i < kInlineCount; i++) {
+        inline_fields_[i] = std::move(other.inline_fields_[i]);
+        inline_hashes_[i] = other.inline_hashes_[i];
+      }
+      heap_fields_ = std::move(other.heap_fields_);
+      heap_hashes_ = std::move(other.heap_hashes_);
+      size_ = other.size_;
+      for (size_t i = 0; i < kKnownCount; i++) {
+        known_[i] = other.known_[i];
+      }
+      other.clear();
+    }
+    return *this;
+  }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  void clear() {
+    for (size_t i = 0; i < size_ && i < kInlineCount; i++) {
+      inline_fields_[i].first.clear();
+      inline_fields_[i].second.clear();
+    }
+    heap_fields_.clear();
+    heap_hashes_.clear();
+    size_ = 0;
+    for (size_t i = 0; i < kKnownCount; i++) {
+      known_[i] = 0;
+    }
+  }
+
+  template <typename K, typename V> iterator emplace(K &&key, V &&val) {
+    if (size_ < kInlineCount) {
+      // Assigning keeps whatever capacity a cleared field still holds.
+      inline_fields_[size_].first = std::forward<K>(key);
+      inline_fields_[size_].second = std::forward<V>(val);
+      return added();
+    }
+    return push_back(value_type(std::forward<K>(key), std::forward<V>(val)));
+  }
+
+  iterator emplace(const char *key, size_t key_len, const char *val,
+                   size_t val_len) {
+    if (size_ < kInlineCount) {
+      inline_fields_[size_].first.assign(key, key_len);
+      inline_fields_[size_].second.assign(val, val_len);
+      return added();
+    }
+    return push_back(
+        value_type(std::string(key, key_len), std::string(val, val_len)));
+  }
+
+  iterator insert(const value_type &field) {
+    return emplace(field.first, field.second);
+  }
+
+  // Returns the `id`th field named `key`, or end().
+  const_iterator find(const char *key, size_t id = 0) const {
+    return data() + index_of(key, strlen(key), id);
+  }
+  iterator find(const char *key, size_t id = 0) {
+    return data() + index_of(key, strlen(key), id);
+  }
+  const_iterator find(const std::string &key, size_t id = 0) const {
+    return data() + index_of(key.data(), key.size(), id);
+  }
+  iterator find(const std::string &key, size_t id = 0) {
+    return data() + index_of(key.data(), key.size(), id);
+  }
+
+  // Returns the first field with the well-known name `key`, or end().
+  const_iterator find(HeaderId key) const {
+    auto i = known_[static_cast<size_t>(key)];
+    return i ? data() + i - 1 : end();
+  }
+  iterator find(HeaderId key) {
+    auto i = known_[static_cast<size_t>(key)];
+    return i ? data() + i - 1 : end();
+  }
+
+  size_t count(const char *key) const {
+    auto n = strlen(key);
+    auto h = detail::header_name_hash(key, n);
+    size_t ret = 0;
+    for (size_t i = 0; i < size_; i++) {
+      if (matches(i, h, key, n)) { ret++; }
+    }
+    return ret;
+  }
+
+  // Removes every field named `key` and returns how many there were.
+  size_t erase(const char *key) {
+    auto n = strlen(key);
+    auto h = detail::header_name_hash(key, n);
+    size_t j = 0;
+    for (size_t i = 0; i < size_; i++) {
+      if (matches(i, h, key, n)) { continue; }
+      if (i != j) {
+        data()[j] = std::move(data()[i]);
+        hashes()[j] = hashes()[i];
+      }
+      j++;
+    }
+    auto ret = size_ - j;
+    while (size_ > j) {
+      pop_back();
+    }
+    if (ret) {
+      for (size_t i = 0; i < kKnownCount; i++) {
+        known_[i] = 0;
+      }
+      for (size_t i = 0; i < size_; i++) {
+        remember(i);
+      }
+    }
+    return ret;
+  }
+
+private:
+  static const size_t kInlineCount = 16;
+  static const size_t kKnownCount = static_cast<size_t>(HeaderId::Unknown);
+
+  bool on_heap() const { return !heap_fields_.empty(); }
+
+  value_type *data() {
+    return on_heap() ? heap_fields_.data() : inline_fields_;
+  }
+  const value_type *data() const {
+    return on_heap() ? heap_fields_.data() : inline_fields_;
+  }
+  uint32_t *hashes() {
+    return on_heap() ? heap_hashes_.data() : inline_hashes_;
+  }
+  const uint32_t *hashes() const {
+    return on_heap() ? heap_hashes_.data() : inline_hashes_;
+  }
+
+  bool matches(size_t i, uint32_t h, const char *key, size_t n) const {
+    return hashes()[i] == h &&
+           detail::header_name_equal(data()[i].first, key, n);
+  }
+
+  size_t index_of(const char *key, size_t n, size_t id) const {
+    auto h = detail::header_name_hash(key, n);
+    for (size_t i = 0; i < size_; i++) {
+      if (matches(i, h, key, n) && id-- == 0) { return i; }
+    }
+    return size_;
+  }
+
+  void remember(size_t i) {
+    const auto &name = data()[i].first;
+    auto id = detail::header_id(name.data(), name.size());
+    if (id != HeaderId::Unknown) {
+      auto &slot = known_[static_cast<size_t>(id)];
+      if (!slot) { slot = static_cast<uint32_t>(i + 1); }
+    }
+  }
+
+  // Hashes and indexes the field just stored at `size_`.
+  iterator added() {
+    const auto &name = data()[size_].first;
+    hashes()[size_] = detail::header_name_hash(name.data(), name.size());
+    remember(size_);
+    return data() + size_++;
+  }
+
+  iterator push_back(value_type field) {
+    if (!on_heap()) {
+      heap_fields_.reserve(kInlineCount * 2);
+      heap_hashes_.reserve(kInlineCount * 2);
+      for (size_t i = 0; i < kInlineCount; i++) {
+        heap_fields_.push_back(std::move(inline_fields_[i]));
+        heap_hashes_.push_back(inline_hashes_[i]);
+      }
+    }
+    heap_fields_.push_back(std::move(field));
+    heap_hashes_.push_back(0);
+    return added();
+  }
+
+  void pop_back() {
+    size_--;
+    if (on_heap()) {
+      heap_fields_.pop_back();
+      heap_hashes_.pop_back();
+      if (size_ <= kInlineCount) {
+        for (size_t i = 0; i < size_; i++) {
+          inline_fields_[i] = std::move(heap_fields_[i]);
+          inline_hashes_[i] = heap_hashes_[i];
+        }
+        heap_fields_.clear();
+        heap_hashes_.clear();
+      }
+    } else {
+      inline_fields_[size_].first.clear();
+      inline_fields_[size_].second.clear();
+    }
+  }
+
+  size_t size_ = 0;
+  value_type inline_fields_[kInlineCount];
+  uint32_t inline_hashes_[kInlineCount];
+  std::vector<value_type> heap_fields_;
+  std::vector<uint32_t> heap_hashes_;
+  uint32_t known_[kKnownCount] = {}; // index + 1 of the first field, or 0
+};
 
 template <typename uint64_t, typename... Args>
 std::pair<std::string, std::string> make_range_header(uint64_t value,
                                                       Args... args);
 
-typedef std::multimap<std::string, std::string> Params;
+// Query and form parameters. Text added with `add_query_text` is only kept
+// until the parameters are needed: `has`, `value` and `value_count` scan it
+// and decode just the values they return, and the map is built the first
+// time any other accessor is used.
+//
+// Thread safety: building the map writes to the object even through the
+// const accessors (`begin`, `end`, `size`, `find`, `count`, `equal_range`).
+// Until it is built, a Params belongs to one thread. `has`, `value`,
+// `value_count` and `empty` never write, and once `parse` has been called
+// no const accessor does, so the object can then be read from several
+// threads at once.
+class Params {
+public:
+  typedef std::multimap<std::string, std::string> map_type;
+  typedef map_type::key_type key_type;
+  typedef map_type::mapped_type mapped_type;
+  typedef map_type::value_type value_type;
+  typedef map_type::size_type size_type;
+  typedef map_type::iterator iterator;
+  typedef map_type::const_iterator const_iterator;
+
+  Params() {}
+  Params(std::initializer_list<value_type> init) : map_(init) {}
+
+  iterator begin() { return map().begin(); }
+  iterator end() { return map().end(); }
+  const_iterator begin() const { return map().begin(); }
+  const_iterator end() const { return map().end(); }
+
+  size_type size() const { return map().size(); }
+  bool empty() const { return map_.empty() && text_.empty(); }
+
+  iterator find(const key_type &key) { return map().find(key); }
+  const_iterator find(const key_type &key) const { return map().find(key); }
+  size_type count(const key_type &key) const { return map().count(key); }
+  std::pair<iterator, iterator> equal_range(const key_type &key) {
+    return map().equal_range(key);
+  }
+  std::pair<const_iterator, const_iterator>
+  equal_range(const key_type &key) const {
+    return map().equal_range(key);
+  }
+
+  template <typename... Args> iterator emplace(Args &&... args) {
+    return map().emplace(std::forward<Args>(args)...);
+  }
+  iterator insert(const value_type &x) { return map().insert(x); }
+  iterator erase(const_iterator it) { return map().erase(it); }
+  size_type erase(const key_type &key) { return map().erase(key); }
+
+  void clear() {
+    map_.clear();
+    text_.clear();
+  }
+
+  // Adds the pairs of `key=value&...` text, which is parsed when needed.
+  void add_query_text(const char *b, const char *e);
+
+  // Builds the map from any text not parsed yet.
+  void parse() { map(); }
+
+  bool has(const char *key) const;
+  std::string value(const char *key, size_t id = 0) const;
+  size_t value_count(const char *key) const;
+
+private:
+  map_type &map() const;
+
+  mutable map_type map_;
+  mutable std::string text_;
+};
 typedef std::smatch Match;
+typedef std::vector<std::pair<std::string, std::string>> PathParams;
 
 typedef std::function<std::string(uint64_t offset)> ContentProducer;
 typedef std::function<void(const char *data, size_t len)> ContentReceiver;
+typedef std::function<size_t(const char *data, size_t len)> BufferConsumer;
 typedef std::function<bool(uint64_t current, uint64_t total)> Progress;
 
 struct MultipartFile {
+  std::string name;
   std::string filename;
   std::string content_type;
   size_t offset = 0;
   size_t length = 0;
 };
 typedef std::multimap<std::string, MultipartFile> MultipartFiles;
+typedef std::function<void(const MultipartFile &file)> MultipartContentHeader;
+
+// Lets a handler read the request body itself, as it arrives. Given only a
+// receiver, it passes the body on unchanged; given a header callback too, it
+// splits a multipart/form-data body and reports each part before its data.
+// The body can be read once. Both return false if it was malformed or too
+// large.
+class ContentReader {
+public:
+  typedef std::function<bool(ContentReceiver receiver)> Reader;
+  typedef std::function<bool(MultipartContentHeader header,
+                             ContentReceiver receiver)>
+      MultipartReader;
+
+  ContentReader(Reader reader, MultipartReader multipart_reader)
+      : reader_(reader), multipart_reader_(multipart_reader) {}
+
+  bool operator()(MultipartContentHeader header,
+                  ContentReceiver receiver) const {
+    return multipart_reader_(header, receiver);
+  }
+
+  bool operator()(ContentReceiver receiver) const { return reader_(receiver); }
+
+private:
+  Reader reader_;
+  MultipartReader multipart_reader_;
+};
 
 struct Request {
   std::string version;
   std::string method;
+  MethodId method_id = MethodId::Unknown;
   std::string target;
   std::string path;
   Headers headers;
@@ -147,13 +734,16 @@ struct Request {
   Params params;
   MultipartFiles files;
   Match matches;
+  PathParams path_params;
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
   const SSL *ssl;
 #endif
 
   bool has_header(const char *key) const;
+  bool has_header(HeaderId key) const;
   std::string get_header_value(const char *key, size_t id = 0) const;
+  std::string get_header_value(HeaderId key) const;
   size_t get_header_value_count(const char *key) const;
   void set_header(const char *key, const char *val);
 
@@ -161,6 +751,9 @@ struct Request {
   std::string get_param_value(const char *key, size_t id = 0) const;
   size_t get_param_value_count(const char *key) const;
 
+  bool has_path_param(const char *key) const;
+  std::string get_path_param_value(const char *key) const;
+
   bool has_file(const char *key) const;
   MultipartFile get_file_value(const char *key) const;
 };
@@ -175,18 +768,31 @@ struct Response {
   ContentReceiver content_receiver;
   Progress progress;
 
+  // Sent as the body when `body` is empty, straight from the file.
+  std::shared_ptr<detail::File> content_file;
+
   bool has_header(const char *key) const;
+  bool has_header(HeaderId key) const;
   std::string get_header_value(const char *key, size_t id = 0) const;
+  std::string get_header_value(HeaderId key) const;
   size_t get_header_value_count(const char *key) const;
   void set_header(const char *key, const char *val);
 
   void set_redirect(const char *uri);
   void set_content(const char *s, size_t n, const char *content_type);
   void set_content(const std::string &s, const char *content_type);
+  bool set_file_content(const std::string &path,
+                        const char *content_type = nullptr);
 
   Response() : status(-1) {}
 };
 
+// One piece of a vectored write.
+struct IoVec {
+  const char *data;
+  size_t size;
+};
+
 class Stream {
  public:
   virtual ~Stream() {}
@@ -195,22 +801,69 @@ class Stream {
   virtual int write(const char *ptr) = 0;
   virtual std::string get_remote_addr() const = 0;
 
+  // Reads up to `size` bytes, stopping after the first '\n'.
+  virtual int read_line(char *ptr, size_t size);
+
+  // Hands buffered input to `consumer` in place. The consumer returns how
+  // many bytes it used, and the rest stay buffered for the next read. Streams
+  // without a read-ahead buffer pass one byte at a time, which the consumer
+  // has to use. Returns the number of bytes used, or the result of a failed
+  // read.
+  virtual int consume(BufferConsumer consumer);
+
+  // Writes the pieces in order, in as few writes as the stream can manage.
+  // Returns the number of bytes written, or -1. Streams that cannot gather
+  // the pieces write them one by one.
+  virtual ssize_t writev(const IoVec *vec, size_t count);
+
+  // Writes `size` bytes of the file from `offset`. Streams that cannot hand
+  // the file to the kernel read it a buffer at a time.
+  virtual bool write_file(const detail::File &file, uint64_t offset,
+                          uint64_t size);
+
+  // Sends what the stream holds back to coalesce with later writes.
+  virtual bool flush();
+
   template <typename... Args>
   void write_format(const char *fmt, const Args &... args);
 };
 
 class SocketStream : public Stream {
  public:
-  SocketStream(socket_t sock);
+  SocketStream(socket_t sock,
+               detail::Timeout read_timeout = {CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                                               CPPHTTPLIB_READ_TIMEOUT_USECOND},
+               detail::Connection *conn = nullptr);
   virtual ~SocketStream();
 
   virtual int read(char *ptr, size_t size);
   virtual int write(const char *ptr, size_t size);
   virtual int write(const char *ptr);
   virtual std::string get_remote_addr() const;
+  virtual int read_line(char *ptr, size_t size);
+  virtual int consume(BufferConsumer consumer);
+  virtual ssize_t writev(const IoVec *vec, size_t count);
+  virtual bool write_file(const detail::File &file, uint64_t offset,
+                          uint64_t size);
+
+  virtual bool flush();
 
  private:
+  // Pieces gathered by one system call.
+  static const size_t kMaxPieces = 16;
+
+  int read_socket(char *ptr, size_t size);
+  int write_socket(const char *ptr, size_t size);
+  ssize_t writev_socket(const IoVec *vec, size_t count);
+
   socket_t sock_;
+  detail::Timeout read_timeout_;
+  detail::Connection *conn_;
+  detail::ReadBuffer own_read_buf_;
+  detail::ReadBuffer *read_buf_;
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  detail::IoUring *ring_;
+#endif
 };
 
 class BufferStream : public Stream {
@@ -229,12 +882,235 @@ class BufferStream : public Stream {
   std::string buffer;
 };
 
+namespace detail {
+
+// Routes of one method. A pattern made of plain segments, `:name` segments
+// and an optional last `*name` segment is stored in a trie keyed by segment,
+// so finding its handler costs one walk down the path. `:name` matches one
+// non-empty segment, `*name` the rest of the path, and both are captured in
+// `Request::path_params`. Any other pattern, including one with a '.', is a
+// regular expression matched with `std::regex_match` as before. As with a
+// plain list of routes, the route added first wins when several match.
+//
+// Two differences from matching every pattern as a regex: `/a/:b` used to
+// match only the literal path `/a/:b`, and a route found in the trie leaves
+// `Request::matches` empty, so its handler reads `req.path` instead of
+// `req.matches[0]`.
+template <typename T> class Router {
+public:
+  void add(const char *pattern, T handler);
+  const T *match(Request &req) const;
+
+private:
+  struct Node {
+    Node *child(const char *b, const char *e, bool create);
+    const Node *child(const char *b, const char *e) const;
+
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;
+    std::unique_ptr<Node> param;
+    size_t route = std::string::npos;
+    size_t wildcard = std::string::npos;
+  };
+
+  struct Route {
+    T handler;
+    std::vector<std::string> names;
+    std::regex re;
+  };
+
+  typedef std::pair<const char *, const char *> Span;
+
+  struct Found {
+    size_t route = std::string::npos;
+    std::vector<Span> spans;
+  };
+
+  static bool is_name(const char *b, const char *e);
+  static bool is_trie_pattern(const char *s);
+  void insert(const char *s, size_t index, std::vector<std::string> &names);
+  static void found(size_t route, const std::vector<Span> &spans,
+                    Found &best);
+  static void find(const Node &node, const char *b, const char *e,
+                   std::vector<Span> &spans, Found &best);
+
+  Node root_;
+  std::vector<Route> routes_;
+  std::vector<size_t> regex_routes_;
+};
+
+template <typename T>
+inline typename Router<T>::Node *
+Router<T>::Node::child(const char *b, const char *e, bool create) {
+  auto n = static_cast<size_t>(e - b);
+  auto it = std::lower_bound(
+      children.begin(), children.end(), n,
+      [&](const std::pair<std::string, std::unique_ptr<Node>> &x, size_t) {
+        return x.first.compare(0, std::string::npos, b, n) < 0;
+      });
+  if (it != children.end() && !it->first.compare(0, std::string::npos, b, n)) {
+    return it->second.get();
+  }
+  if (!create) { return nullptr; }
+  it = children.emplace(it, std::string(b, e), std::unique_ptr<Node>(new Node));
+  return it->second.get();
+}
+
+template <typename T>
+inline const typename Router<T>::Node *
+Router<T>::Node::child(const char *b, const char *e) const {
+  return const_cast<Node *>(this)->child(b, e, false);
+}
+
+template <typename T>
+inline bool Router<T>::is_name(const char *b, const char *e) {
+  if (b == e) { return false; }
+  for (; b < e; b++) {
+    if (!isalnum(static_cast<unsigned char>(*b)) && *b != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T> inline bool Router<T>::is_trie_pattern(const char *s) {
+  if (*s != '/') { return false; }
+  s++;
+  for (;;) {
+    auto e = s + strcspn(s, "/");
+    if (*s == ':' || *s == '*') {
+      if (!is_name(s + 1, e) || (*s == '*' && *e)) { return false; }
+    } else if (static_cast<size_t>(e - s) !=
+               strcspn(s, "\\^$.|?*+()[]{}/")) {
+      return false;
+    }
+    if (!*e) { return true; }
+    s = e + 1;
+  }
+}
+
+template <typename T>
+inline void Router<T>::insert(const char *s, size_t index,
+                              std::vector<std::string> &names) {
+  auto node = &root_;
+  s++;
+  for (;;) {
+    auto e = s + strcspn(s, "/");
+    if (*s == '*') {
+      names.emplace_back(s + 1, e);
+      if (node->wildcard == std::string::npos) { node->wildcard = index; }
+      return;
+    }
+    if (*s == ':') {
+      names.emplace_back(s + 1, e);
+      if (!node->param) { node->param.reset(new Node); }
+      node = node->param.get();
+    } else {
+      node = node->child(s, e, true);
+    }
+    if (!*e) {
+      if (node->route == std::string::npos) { node->route = index; }
+      return;
+    }
+    s = e + 1;
+  }
+}
+
+template <typename T>
+inline void Router<T>::add(const char *pattern, T handler) {
+  Route route;
+  if (!is_trie_pattern(pattern)) {
+    route.re = std::regex(pattern);
+    regex_routes_.push_back(routes_.size());
+  } else {
+    insert(pattern, routes_.size(), route.names);
+  }
+  route.handler = std::move(handler);
+  routes_.push_back(std::move(route));
+}
+
+template <typename T>
+inline void Router<T>::found(size_t route, const std::vector<Span> &spans,
+                             Found &best) {
+  if (route < best.route) {
+    best.route = route;
+    best.spans = spans;
+  }
+}
+
+// Visits every route matching the path from `b`, the start of a segment,
+// keeping the one added first.
+template <typename T>
+inline void Router<T>::find(const Node &node, const char *b, const char *e,
+                            std::vector<Span> &spans, Found &best) {
+  if (node.wildcard < best.route) {
+    spans.emplace_back(b, e);
+    found(node.wildcard, spans, best);
+    spans.pop_back();
+  }
+
+  auto end =
+      static_cast<const char *>(memchr(b, '/', static_cast<size_t>(e - b)));
+  if (!end) { end = e; }
+
+  auto child = node.child(b, end);
+  if (child) {
+    if (end == e) {
+      found(child->route, spans, best);
+    } else {
+      find(*child, end + 1, e, spans, best);
+    }
+  }
+
+  if (node.param && b < end) {
+    spans.emplace_back(b, end);
+    if (end == e) {
+      found(node.param->route, spans, best);
+    } else {
+      find(*node.param, end + 1, e, spans, best);
+    }
+    spans.pop_back();
+  }
+}
+
+template <typename T> inline const T *Router<T>::match(Request &req) const {
+  const auto &path = req.path;
+
+  Found best;
+  if (!path.empty() && path[0] == '/') {
+    std::vector<Span> spans;
+    find(root_, path.data() + 1, path.data() + path.size(), spans, best);
+  }
+
+  // Regex routes only need to be tried up to the trie's match.
+  for (auto i : regex_routes_) {
+    if (i > best.route) { break; }
+    if (std::regex_match(path, req.matches, routes_[i].re)) {
+      return &routes_[i].handler;
+    }
+  }
+
+  if (best.route == std::string::npos) { return nullptr; }
+
+  const auto &route = routes_[best.route];
+  for (size_t i = 0; i < best.spans.size(); i++) {
+    const auto &span = best.spans[i];
+    req.path_params.emplace_back(route.names[i],
+                                 std::string(span.first, span.second));
+  }
+  return &route.handler;
+}
+
+} // namespace detail
+
 class Server {
  public:
   typedef std::function<void(const Request &, Response &)> Handler;
   typedef std::function<void(const Request &, const Response &)> Logger;
+  typedef std::function<void(const Request &, Response &,
+                             const ContentReader &)>
+      HandlerWithContentReader;
 
-  Server();
+  Server(ServerMode mode = ServerMode::ThreadPool);
 
   virtual ~Server();
 
@@ -242,11 +1118,15 @@ class Server {
 
   Server &Get(const char *pattern, Handler handler);
   Server &Post(const char *pattern, Handler handler);
+  Server &Post(const char *pattern, HandlerWithContentReader handler);
 
   Server &Put(const char *pattern, Handler handler);
+  Server &Put(const char *pattern, HandlerWithContentReader handler);
   Server &Patch(const char *pattern, Handler handler);
+  Server &Patch(const char *pattern, HandlerWithContentReader handler);
   Server &Delete(const char *pattern, Handler handler);
   Server &Options(const char *pattern, Handler handler);
+  Server &Route(const char *method, const char *pattern, Handler handler);
 
   bool set_base_dir(const char *path);
 
@@ -254,7 +1134,25 @@ class Server {
   void set_logger(Logger logger);
 
   void set_keep_alive_max_count(size_t count);
+  void set_keep_alive_timeout(time_t sec, time_t usec = 0);
+  void set_handshake_timeout(time_t sec, time_t usec = 0);
+  void set_header_read_timeout(time_t sec, time_t usec = 0);
+  void set_body_read_timeout(time_t sec, time_t usec = 0);
+  void set_write_timeout(time_t sec, time_t usec = 0);
   void set_payload_max_length(uint64_t length);
+  void set_reuse_request_storage(bool on);
+  void set_file_cache(size_t max_count,
+                      time_t ttl_sec = CPPHTTPLIB_FILE_CACHE_TTL_SECOND);
+  // The counts below are for the whole server. With several acceptors,
+  // the event loops and pool workers are split between them as evenly as
+  // possible, and each acceptor gets at least one of each; so there are
+  // never more acceptors than pool workers. Extra acceptors need
+  // SO_REUSEPORT (Linux); binding fails if one of their sockets can't be
+  // created. Elsewhere the server has a single acceptor.
+  void set_event_loop_count(size_t count);
+  void set_thread_pool(size_t count, size_t queue_max,
+                       QueueFullPolicy policy = QueueFullPolicy::Block);
+  void set_acceptor_count(size_t count = 0);
 
   int bind_to_any_port(const char *host, int socket_flags = 0);
   bool listen_after_bind();
@@ -267,44 +1165,66 @@ class Server {
  protected:
   bool process_request(Stream &strm, bool last_connection,
                        bool &connection_close,
-                       std::function<void(Request &)> setup_request = nullptr);
+                       std::function<void(Request &)> setup_request = nullptr,
+                       detail::Connection *conn = nullptr);
+
+  virtual bool process_connection(detail::Connection &conn);
+  virtual void close_connection(detail::Connection &conn);
+
+  void write_response(Stream &strm, bool last_connection, const Request &req,
+                      Response &res);
 
   size_t keep_alive_max_count_;
+  detail::StageTimeouts timeouts_;
   size_t payload_max_length_;
 
  private:
-  typedef std::vector<std::pair<std::regex, Handler>> Handlers;
+  typedef detail::Router<Handler> Handlers;
+  typedef detail::Router<HandlerWithContentReader> HandlersForContentReader;
 
   socket_t create_server_socket(const char *host, int port,
                                 int socket_flags) const;
   int bind_internal(const char *host, int port, int socket_flags);
   bool listen_internal();
+  bool accept_loop(socket_t sock, size_t index, size_t acceptor_count);
+  void close_server_socket();
 
+  Handlers &handlers(MethodId method);
+  HandlersForContentReader &handlers_for_content_reader(MethodId method);
   bool routing(Request &req, Response &res);
   bool handle_file_request(Request &req, Response &res);
   bool dispatch_request(Request &req, Response &res, Handlers &handlers);
+  void dispatch_request_for_content_reader(
+      Stream &strm, Request &req, Response &res,
+      const HandlerWithContentReader &handler);
 
   bool parse_request_line(const char *s, Request &req);
-  void write_response(Stream &strm, bool last_connection, const Request &req,
-                      Response &res);
-
-  virtual bool read_and_close_socket(socket_t sock);
-
+  bool handle_request(Stream &strm, detail::stream_line_reader &reader,
+                      bool last_connection, bool &connection_close,
+                      const std::function<void(Request &)> &setup_request,
+                      detail::Connection *conn, Request &req, Response &res);
+
+  bool read_and_close_socket(socket_t sock, detail::TimerWheel *wheel);
+  virtual void reject_connection(detail::Connection &conn);
+
+  const ServerMode mode_;
+  size_t event_loop_count_;
+  size_t thread_pool_count_;
+  size_t thread_pool_queue_max_;
+  QueueFullPolicy queue_full_policy_;
+  size_t acceptor_count_;
+  bool reuse_request_storage_;
   std::atomic<bool> is_running_;
   std::atomic<socket_t> svr_sock_;
+  std::vector<socket_t> reuse_port_socks_;
   std::string base_dir_;
-  Handlers get_handlers_;
-  Handlers post_handlers_;
-  Handlers put_handlers_;
-  Handlers patch_handlers_;
-  Handlers delete_handlers_;
-  Handlers options_handlers_;
+  std::unique_ptr<detail::FileCache> file_cache_;
+  static const size_t kMethodCount = static_cast<size_t>(MethodId::Unknown);
+  Handlers handlers_[kMethodCount];
+  HandlersForContentReader handlers_for_content_reader_[kMethodCount];
+  std::unordered_map<std::string, Handlers> custom_handlers_;
   Handler error_handler_;
   Logger logger_;
-
-  // TODO: Use thread pool...
-  std::mutex running_threads_mutex_;
-  int running_threads_;
 };
 
 class Client {
@@ -385,31 +1305,52 @@ class Client {
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 class SSLSocketStream : public Stream {
 public:
-  SSLSocketStream(socket_t sock, SSL *ssl);
+  SSLSocketStream(socket_t sock, SSL *ssl,
+                  detail::Timeout read_timeout = {
+                      CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                      CPPHTTPLIB_READ_TIMEOUT_USECOND},
+                  detail::Connection *conn = nullptr);
   virtual ~SSLSocketStream();
 
   virtual int read(char *ptr, size_t size);
   virtual int write(const char *ptr, size_t size);
   virtual int write(const char *ptr);
   virtual std::string get_remote_addr() const;
+  virtual int read_line(char *ptr, size_t size);
+  virtual int consume(BufferConsumer consumer);
+  virtual ssize_t writev(const IoVec *vec, size_t count);
+
+  virtual bool flush();
 
 private:
+  int read_ssl(char *ptr, size_t size);
+  int write_ssl(const char *ptr, size_t size);
+
   socket_t sock_;
   SSL *ssl_;
+  detail::Timeout read_timeout_;
+  detail::Connection *conn_;
+  detail::ReadBuffer own_read_buf_;
+  detail::ReadBuffer *read_buf_;
 };
 
 class SSLServer : public Server {
 public:
   SSLServer(const char *cert_path, const char *private_key_path,
             const char *client_ca_cert_file_path = nullptr,
-            const char *client_ca_cert_dir_path = nullptr);
+            const char *client_ca_cert_dir_path = nullptr,
+            ServerMode mode = ServerMode::ThreadPool);
 
   virtual ~SSLServer();
 
   virtual bool is_valid() const;
 
+protected:
+  virtual bool process_connection(detail::Connection &conn);
+  virtual void close_connection(detail::Connection &conn);
+
 private:
-  virtual bool read_and_close_socket(socket_t sock);
+  virtual void reject_connection(detail::Connection &conn);
 
   SSL_CTX *ctx_;
   std::mutex ctx_mutex_;
@@ -456,34 +1397,51 @@ private:
  */
 namespace detail {
 
-inline bool is_hex(char c, int &v) {
-  if (0x20 <= c && isdigit(c)) {
-    v = c - '0';
-    return true;
-  } else if ('A' <= c && c <= 'F') {
-    v = c - 'A' + 10;
-    return true;
-  } else if ('a' <= c && c <= 'f') {
-    v = c - 'a' + 10;
-    return true;
-  }
-  return false;
-}
+// Characters other than NUL and non-ASCII bytes that encode_url escapes.
+inline const char *url_escaped_chars() { return " +\r\n',:;"; }
 
-inline bool from_hex_to_i(const std::string &s, size_t i, size_t cnt,
-                          int &val) {
-  if (i >= s.size()) { return false; }
+// Character classes for URL coding, built once. `hex` holds the value of a
+// hex digit or -1, and `escape` marks the bytes encode_url escapes.
+struct UrlCodeTables {
+  int8_t hex[256];
+  bool escape[256];
 
-  val = 0;
-  for (; cnt; i++, cnt--) {
-    if (!s[i]) { return false; }
-    int v = 0;
-    if (is_hex(s[i], v)) {
-      val = val * 16 + v;
-    } else {
-      return false;
+  UrlCodeTables() {
+    for (int c = 0; c < 256; c++) {
+      hex[c] = -1;
+      escape[c] = c >= 0x80;
+    }
+    for (int c = 0; c < 10; c++) {
+      hex['0' + c] = static_cast<int8_t>(c);
+    }
+    for (int c = 0; c < 6; c++) {
+      hex['a' + c] = hex['A' + c] = static_cast<int8_t>(10 + c);
+    }
+    for (auto p = url_escaped_chars(); *p; p++) {
+      escape[static_cast<uint8_t>(*p)] = true;
     }
   }
+};
+
+inline const UrlCodeTables &url_code_tables() {
+  static const UrlCodeTables tables;
+  return tables;
+}
+
+inline int hex_value(char c) {
+  return url_code_tables().hex[static_cast<uint8_t>(c)];
+}
+
+// Reads `cnt` hex digits at `p` into `val`.
+inline bool from_hex_to_i(const char *p, const char *e, size_t cnt, int &val) {
+  if (static_cast<size_t>(e - p) < cnt) { return false; }
+
+  val = 0;
+  for (; cnt; p++, cnt--) {
+    auto v = hex_value(*p);
+    if (v < 0) { return false; }
+    val = val * 16 + v;
+  }
   return true;
 }
 
@@ -539,6 +1497,181 @@ inline bool is_dir(const std::string &path) {
   return stat(path.c_str(), &st) >= 0 && S_ISDIR(st.st_mode);
 }
 
+// The nanoseconds part of the modification time, where the platform keeps
+// one. A file rewritten within the same second differs only here.
+inline long mtime_nsec(const struct stat &st) {
+#if defined(__APPLE__)
+  return st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  (void)st;
+  return 0;
+#else
+  return st.st_mtim.tv_nsec;
+#endif
+}
+
+// An open regular file, with what a response sending it needs. The
+// descriptor is closed when the last response sending it is done with it.
+struct File {
+  File(int fd, const struct stat &st)
+      : fd(fd), size(static_cast<uint64_t>(st.st_size)), mtime(st.st_mtime),
+        mtime_nsec(detail::mtime_nsec(st)),
+        dev_(static_cast<uint64_t>(st.st_dev)),
+        ino_(static_cast<uint64_t>(st.st_ino)) {}
+  ~File() { close(fd); }
+
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+
+  // Whether `st` still describes the file that was opened.
+  bool is_same(const struct stat &st) const {
+    return static_cast<uint64_t>(st.st_dev) == dev_ &&
+           static_cast<uint64_t>(st.st_ino) == ino_ &&
+           static_cast<uint64_t>(st.st_size) == size && st.st_mtime == mtime &&
+           detail::mtime_nsec(st) == mtime_nsec;
+  }
+
+  const int fd;
+  const uint64_t size;
+  const time_t mtime;
+  const long mtime_nsec;
+  std::string etag;
+  std::string last_modified;
+  const char *content_type = nullptr;
+
+private:
+  const uint64_t dev_;
+  const uint64_t ino_;
+};
+
+inline const char *find_content_type(const std::string &path);
+inline size_t format_http_date(time_t t, char *buf);
+
+inline std::shared_ptr<File> open_file(const std::string &path) {
+#ifdef _WIN32
+  auto fd = open(path.c_str(), O_RDONLY | O_BINARY);
+#else
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+  if (fd < 0) { return nullptr; }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto file = std::make_shared<File>(fd, st);
+
+  // Some file systems keep the mtime only to the second, so the tag is weak.
+  char buf[80];
+  snprintf(buf, sizeof(buf), "W/\"%llx-%llx-%llx.%lx\"",
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<unsigned long long>(file->size),
+           static_cast<unsigned long long>(file->mtime),
+           static_cast<unsigned long>(file->mtime_nsec));
+  file->etag = buf;
+  file->last_modified.assign(buf, format_http_date(file->mtime, buf));
+  file->content_type = find_content_type(path);
+  return file;
+}
+
+// Files opened for requests, by path. An entry is trusted for the TTL after
+// it was last checked; past that a stat tells whether the file is still the
+// one that was opened, and if not it is opened again. The least recently
+// used entry makes room when the cache is full.
+class FileCache {
+public:
+  FileCache(size_t max_count, time_t ttl_sec)
+      : max_count_(max_count), ttl_(std::chrono::seconds(ttl_sec)) {}
+
+  std::shared_ptr<File> get(const std::string &path) {
+    auto now = std::chrono::steady_clock::now();
+
+    std::shared_ptr<File> file;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      auto it = map_.find(path);
+      if (it != map_.end()) {
+        auto entry = it->second;
+        lru_.splice(lru_.begin(), lru_, entry);
+        if (now - entry->checked < ttl_) { return entry->file; }
+        file = entry->file;
+      }
+    }
+
+    struct stat st;
+    if (!file || stat(path.c_str(), &st) < 0 || !file->is_same(st)) {
+      file = open_file(path);
+    }
+    put(path, file, now);
+    return file;
+  }
+
+private:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<File> file;
+    std::chrono::steady_clock::time_point checked;
+  };
+
+  void put(const std::string &path, const std::shared_ptr<File> &file,
+           std::chrono::steady_clock::time_point checked) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = map_.find(path);
+    if (!file) {
+      if (it != map_.end()) {
+        lru_.erase(it->second);
+        map_.erase(it);
+      }
+      return;
+    }
+
+    if (it != map_.end()) {
+      it->second->file = file;
+      it->second->checked = checked;
+      return;
+    }
+
+    lru_.push_front(Entry{path, file, checked});
+    map_.emplace(path, lru_.begin());
+    if (lru_.size() > max_count_) {
+      map_.erase(lru_.back().path);
+      lru_.pop_back();
+    }
+  }
+
+  const size_t max_count_;
+  const std::chrono::steady_clock::duration ttl_;
+  std::mutex mutex_;
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> map_;
+};
+
+// Reads at `offset` without moving a shared file position, as a cached File
+// is read by several workers at once.
+inline int read_file_at(const File &file, char *ptr, size_t size,
+                        uint64_t offset) {
+#ifdef _WIN32
+  auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(file.fd));
+  if (handle == INVALID_HANDLE_VALUE) { return -1; }
+
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = static_cast<DWORD>(offset);
+  ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+  DWORD n = 0;
+  if (!ReadFile(handle, ptr, static_cast<DWORD>(size), &n, &ov)) {
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  }
+  return static_cast<int>(n);
+#else
+  return static_cast<int>(
+      pread(file.fd, ptr, size, static_cast<off_t>(offset)));
+#endif
+}
+
 inline bool is_valid_path(const std::string &path) {
   size_t level = 0;
   size_t i = 0;
@@ -576,20 +1709,16 @@ inline bool is_valid_path(const std::string &path) {
   return true;
 }
 
-inline void read_file(const std::string &path, std::string &out) {
-  std::ifstream fs(path, std::ios_base::binary);
-  fs.seekg(0, std::ios_base::end);
-  auto size = fs.tellg();
-  fs.seekg(0);
-  out.resize(static_cast<size_t>(size));
-  fs.read(&out[0], size);
-}
-
+// The alphanumeric run after the last '.', if it ends the path.
 inline std::string file_extension(const std::string &path) {
-  std::smatch m;
-  auto pat = std::regex("\\.([a-zA-Z0-9]+)$");
-  if (std::regex_search(path, m, pat)) { return m[1].str(); }
-  return std::string();
+  auto i = path.size();
+  while (i > 0 && isalnum(static_cast<unsigned char>(path[i - 1]))) {
+    i--;
+  }
+  if (i == path.size() || i == 0 || path[i - 1] != '.') {
+    return std::string();
+  }
+  return path.substr(i);
 }
 
 template <class Fn> void split(const char *b, const char *e, char d, Fn fn) {
@@ -635,39 +1764,40 @@ class stream_line_reader {
     fixed_buffer_used_size_ = 0;
     glowable_buffer_.clear();
 
-    for (size_t i = 0;; i++) {
-      char byte;
-      auto n = strm_.read(&byte, 1);
+    for (;;) {
+      char chunk[CPPHTTPLIB_RECV_BUFSIZ];
+      auto n = strm_.read_line(chunk, sizeof(chunk));
 
       if (n < 0) {
         return false;
       } else if (n == 0) {
-        if (i == 0) {
+        if (size() == 0) {
           return false;
         } else {
           break;
         }
       }
 
-      append(byte);
+      append(chunk, static_cast<size_t>(n));
 
-      if (byte == '\n') { break; }
+      if (chunk[n - 1] == '\n') { break; }
     }
 
     return true;
   }
 
  private:
-  void append(char c) {
-    if (fixed_buffer_used_size_ < fixed_buffer_size_ - 1) {
-      fixed_buffer_[fixed_buffer_used_size_++] = c;
+  void append(const char *s, size_t n) {
+    if (glowable_buffer_.empty() &&
+        fixed_buffer_used_size_ + n < fixed_buffer_size_) {
+      memcpy(fixed_buffer_ + fixed_buffer_used_size_, s, n);
+      fixed_buffer_used_size_ += n;
       fixed_buffer_[fixed_buffer_used_size_] = '\0';
     } else {
       if (glowable_buffer_.empty()) {
-        assert(fixed_buffer_[fixed_buffer_used_size_] == '\0');
         glowable_buffer_.assign(fixed_buffer_, fixed_buffer_used_size_);
       }
-      glowable_buffer_ += c;
+      glowable_buffer_.append(s, n);
     }
   }
 
@@ -686,33 +1816,38 @@ inline int close_socket(socket_t sock) {
 #endif
 }
 
-inline int select_read(socket_t sock, time_t sec, time_t usec) {
-  fd_set fds;
-  FD_ZERO(&fds);
-  FD_SET(sock, &fds);
+// NOTE: poll has no FD_SETSIZE limit, so these stay valid for any
+// descriptor number a busy process may hand out.
+inline int poll_socket(socket_t sock, short events, const Timeout &timeout,
+                       short &revents) {
+  struct pollfd pfd;
+  pfd.fd = sock;
+  pfd.events = events;
+  pfd.revents = 0;
 
-  timeval tv;
-  tv.tv_sec = static_cast<long>(sec);
-  tv.tv_usec = static_cast<long>(usec);
+#ifdef _WIN32
+  auto ret = WSAPoll(&pfd, 1, timeout.poll_milliseconds());
+#else
+  int ret;
+  do {
+    ret = poll(&pfd, 1, timeout.poll_milliseconds());
+  } while (ret < 0 && errno == EINTR);
+#endif
 
-  return select(static_cast<int>(sock + 1), &fds, nullptr, nullptr, &tv);
+  revents = pfd.revents;
+  return ret;
 }
 
-inline bool wait_until_socket_is_ready(socket_t sock, time_t sec, time_t usec) {
-  fd_set fdsr;
-  FD_ZERO(&fdsr);
-  FD_SET(sock, &fdsr);
-
-  auto fdsw = fdsr;
-  auto fdse = fdsr;
-
-  timeval tv;
-  tv.tv_sec = static_cast<long>(sec);
-  tv.tv_usec = static_cast<long>(usec);
+inline int poll_read(socket_t sock, const Timeout &timeout) {
+  short revents;
+  return poll_socket(sock, POLLIN, timeout, revents);
+}
 
-  if (select(static_cast<int>(sock + 1), &fdsr, &fdsw, &fdse, &tv) < 0) {
+inline bool wait_until_socket_is_ready(socket_t sock, const Timeout &timeout) {
+  short revents;
+  if (poll_socket(sock, POLLIN | POLLOUT, timeout, revents) < 0) {
     return false;
-  } else if (FD_ISSET(sock, &fdsr) || FD_ISSET(sock, &fdsw)) {
+  } else if (revents & (POLLIN | POLLOUT | POLLERR | POLLHUP)) {
     int error = 0;
     socklen_t len = sizeof(error);
     if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&error, &len) < 0 ||
@@ -733,9 +1868,9 @@ inline bool read_and_close_socket(socket_t sock, size_t keep_alive_max_count,
 
   if (keep_alive_max_count > 0) {
     auto count = keep_alive_max_count;
-    while (count > 0 &&
-        detail::select_read(sock, CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
-                            CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND) > 0) {
+    const Timeout keep_alive_timeout{CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
+                                     CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND};
+    while (count > 0 && detail::poll_read(sock, keep_alive_timeout) > 0) {
       SocketStream strm(sock);
       auto last_connection = count == 1;
       auto connection_close = false;
@@ -763,6 +1898,1072 @@ inline int shutdown_socket(socket_t sock) {
 #endif
 }
 
+// Fixed set of workers fed from a bounded queue. `enqueue` either blocks
+// until there is room or fails when the queue is full.
+class ThreadPool {
+public:
+  ThreadPool(size_t count, size_t queue_max)
+      : queue_max_(queue_max), shutdown_(false) {
+    while (count--) {
+      threads_.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ThreadPool() { shutdown(); }
+
+  bool enqueue(std::function<void()> fn, bool block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (jobs_.size() >= queue_max_) {
+      if (!block) { return false; }
+      space_cond_.wait(
+          lock, [&] { return jobs_.size() < queue_max_ || shutdown_; });
+    }
+    if (shutdown_) { return false; }
+    jobs_.push_back(std::move(fn));
+    lock.unlock();
+    job_cond_.notify_one();
+    return true;
+  }
+
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (shutdown_) { return; }
+      shutdown_ = true;
+    }
+    job_cond_.notify_all();
+    space_cond_.notify_all();
+
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+
+private:
+  void work() {
+    for (;;) {
+      std::function<void()> fn;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_cond_.wait(lock, [&] { return !jobs_.empty() || shutdown_; });
+        if (jobs_.empty()) { return; }
+        fn = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      space_cond_.notify_one();
+      fn();
+    }
+  }
+
+  const size_t queue_max_;
+  bool shutdown_;
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable job_cond_;
+  std::condition_variable space_cond_;
+};
+
+struct TimerNode {
+  TimerNode *prev = nullptr;
+  TimerNode *next = nullptr;
+  uint64_t expires = 0;
+  uint64_t interval = 0;
+  void *data = nullptr;
+
+  // Latest interval asked for by `TimerWheel::schedule`, zero to unlink the
+  // node, and the link of the wheel's list of nodes waiting to be applied.
+  std::atomic<uint64_t> requested{0};
+  std::atomic<bool> queued{false};
+  TimerNode *queue_next = nullptr;
+};
+
+// Hierarchical timing wheel: four levels of 64 slots, each slot of a level
+// spanning a whole revolution of the level below. Nodes are linked into their
+// slot intrusively, so scheduling and cancelling are O(1); advancing moves the
+// nodes of a higher level slot down once the level below has wrapped around.
+//
+// The wheel is shared by the thread that advances it and the threads that
+// (re)schedule nodes. Scheduling doesn't take the wheel lock: it records the
+// interval in the node and queues it on a lock-free list, which `advance`
+// applies once per tick, so a node rescheduled several times within a tick
+// is relinked only once. `cancel` takes the lock and must be called before a
+// node is destroyed. The expiry handler runs with the lock held and returns
+// true to keep the node armed for another interval.
+class TimerWheel {
+public:
+  typedef std::function<bool(TimerNode &)> Handler;
+
+  TimerWheel(std::chrono::milliseconds tick, Handler handler)
+      : tick_(tick), handler_(handler),
+        start_(std::chrono::steady_clock::now()), now_(0) {
+    for (auto &level : slots_) {
+      for (auto &head : level) {
+        head.prev = head.next = &head;
+      }
+    }
+  }
+
+  // Arms the node to expire `timeout` after the next tick.
+  void schedule(TimerNode &node, const Timeout &timeout) {
+    auto ticks = (timeout.duration().count() + tick_.count() - 1) /
+                 tick_.count();
+    request(node, std::max<uint64_t>(1, static_cast<uint64_t>(ticks)));
+  }
+
+  // Disarms the node as of the next tick.
+  void unschedule(TimerNode &node) { request(node, 0); }
+
+  void cancel(TimerNode &node) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    apply_requests();
+    unlink(node);
+  }
+
+  void advance(std::chrono::steady_clock::time_point now) {
+    auto target = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - start_)
+            .count() /
+        tick_.count());
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    apply_requests();
+    while (now_ < target) {
+      now_++;
+
+      // Each time a level wraps around, the current slot of the level above
+      // is due and its nodes are spread over the levels below.
+      for (size_t level = 1; level < kLevels; level++) {
+        if ((now_ >> (kBits * (level - 1))) & kMask) { break; }
+        relink_slot(slots_[level][(now_ >> (kBits * level)) & kMask]);
+      }
+
+      expire_slot(slots_[0][now_ & kMask]);
+    }
+  }
+
+private:
+  static const size_t kLevels = 4;
+  static const size_t kBits = 6;
+  static const uint64_t kSlots = 1 << kBits;
+  static const uint64_t kMask = kSlots - 1;
+
+  void request(TimerNode &node, uint64_t interval) {
+    node.requested = interval;
+    if (node.queued.exchange(true)) { return; }
+
+    auto head = requests_.load();
+    do {
+      node.queue_next = head;
+    } while (!requests_.compare_exchange_weak(head, &node));
+  }
+
+  // A node queued again while this runs is applied by the next call, with
+  // the interval requested last.
+  void apply_requests() {
+    auto node = requests_.exchange(nullptr);
+    while (node) {
+      auto next = node->queue_next;
+      node->queued = false;
+      auto interval = node->requested.load();
+      unlink(*node);
+      if (interval) {
+        node->interval = interval;
+        node->expires = now_ + interval;
+        link(*node);
+      }
+      node = next;
+    }
+  }
+
+  static void unlink(TimerNode &node) {
+    if (!node.next) { return; }
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+  }
+
+  void link(TimerNode &node) {
+    const uint64_t max_delta = (uint64_t(1) << (kBits * kLevels)) - 1;
+    if (node.expires - now_ > max_delta) { node.expires = now_ + max_delta; }
+
+    auto delta = node.expires - now_;
+    size_t level = 0;
+    while (level + 1 < kLevels &&
+           delta >= (uint64_t(1) << (kBits * (level + 1)))) {
+      level++;
+    }
+
+    auto &head = slots_[level][(node.expires >> (kBits * level)) & kMask];
+    node.prev = &head;
+    node.next = head.next;
+    head.next->prev = &node;
+    head.next = &node;
+  }
+
+  // Moves the nodes of a slot to a local list first, so the callback may link
+  // a node again without ever seeing it twice.
+  template <typename Fn> static void take_slot(TimerNode &head, Fn fn) {
+    if (head.next == &head) { return; }
+
+    TimerNode list;
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.prev = head.next = &head;
+
+    while (list.next != &list) {
+      auto node = list.next;
+      unlink(*node);
+      fn(*node);
+    }
+  }
+
+  void relink_slot(TimerNode &head) {
+    take_slot(head, [&](TimerNode &node) { link(node); });
+  }
+
+  void expire_slot(TimerNode &head) {
+    take_slot(head, [&](TimerNode &node) {
+      // A node rescheduled since the last tick keeps its old deadline until
+      // the request is applied, so it doesn't expire on that one.
+      if (node.expires > now_) {
+        link(node);
+      } else if (node.queued || handler_(node)) {
+        node.expires = now_ + node.interval;
+        link(node);
+      }
+    });
+  }
+
+  const std::chrono::milliseconds tick_;
+  Handler handler_;
+  const std::chrono::steady_clock::time_point start_;
+  uint64_t now_;
+  TimerNode slots_[kLevels][kSlots];
+  std::atomic<TimerNode *> requests_{nullptr};
+  std::mutex mutex_;
+};
+
+struct RequestStorageCounters {
+  std::atomic<uint64_t> requests;
+  std::atomic<uint64_t> recycled;
+  std::atomic<uint64_t> released;
+};
+
+inline RequestStorageCounters &request_storage_counters() {
+  static RequestStorageCounters counters{{0}, {0}, {0}};
+  return counters;
+}
+
+// Request and response shared by all requests of a connection. Clearing them
+// keeps the capacity of their strings and header fields, so from the second
+// request on the parser mostly writes into memory the connection owns. The
+// counts are added to the process wide counters once, when the connection
+// goes away.
+struct RequestStorage {
+  Request req;
+  Response res;
+  std::string header_block;
+  uint64_t requests = 0;
+  uint64_t recycled = 0;
+  uint64_t released = 0;
+
+  ~RequestStorage() {
+    auto &counters = request_storage_counters();
+    counters.requests += requests;
+    counters.recycled += recycled;
+    counters.released += released;
+  }
+
+  void reset() {
+    req.version.clear();
+    req.method.clear();
+    req.method_id = MethodId::Unknown;
+    req.target.clear();
+    req.path.clear();
+    req.headers.clear();
+    clear_body(req.body);
+    req.params.clear();
+    req.files.clear();
+    req.path_params.clear();
+    // Only regex routes overwrite `req.matches`.
+    if (!req.matches.empty()) { req.matches = Match(); }
+
+    res.version.clear();
+    res.status = -1;
+    res.headers.clear();
+    clear_body(res.body);
+    res.content_producer = nullptr;
+    res.content_receiver = nullptr;
+    res.progress = nullptr;
+    res.content_file.reset();
+
+    recycled++;
+  }
+
+private:
+  void clear_body(std::string &body) {
+    if (body.capacity() > CPPHTTPLIB_REUSED_BODY_MAX_CAPACITY) {
+      std::string().swap(body);
+      released++;
+    } else {
+      body.clear();
+    }
+  }
+};
+
+struct Connection {
+  Connection() { timer.data = this; }
+  ~Connection() {
+    if (wheel) { wheel->cancel(timer); }
+  }
+
+  socket_t sock = INVALID_SOCKET;
+  size_t keep_alive_count = 0;
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+  SSL *ssl = nullptr;
+#endif
+
+  // Deadline supervision. `progress` counts the reads and writes done by the
+  // connection's streams, so an expired inactivity deadline can tell whether
+  // it only needs to be extended.
+  TimerWheel *wheel = nullptr;
+  const StageTimeouts *timeouts = nullptr;
+  TimerNode timer;
+  std::atomic<int> stage{static_cast<int>(Stage::None)};
+  // Whether the current stage has a deadline. Without one, reads wait in
+  // poll with the stream's read timeout instead of blocking in recv.
+  bool supervised = false;
+  std::atomic<uint64_t> progress{0};
+  std::atomic<uint64_t> progress_mark{0};
+
+  // Read-ahead and pending output of the connection's streams. Bytes read
+  // past the end of a request stay here for the next one, and the responses
+  // to pipelined requests are held back until the connection would block.
+  ReadBuffer read_buf;
+  std::string write_buf;
+
+  // Set up on the first request when the server reuses request storage.
+  std::unique_ptr<RequestStorage> storage;
+
+  bool has_buffered_input() const { return !read_buf.empty(); }
+};
+
+inline RequestStorage &reuse_request_storage(Connection &conn) {
+  if (conn.storage) {
+    conn.storage->reset();
+  } else {
+    conn.storage.reset(new RequestStorage);
+  }
+  conn.storage->requests++;
+  return *conn.storage;
+}
+
+// Refills `buf` when it is empty. Returns the number of unread bytes, or the
+// result of the failed read.
+template <typename T> inline int fill_buffer(ReadBuffer &buf, T read) {
+  if (buf.empty()) {
+    buf.data.resize(CPPHTTPLIB_RECV_BUFSIZ);
+    auto n = read(buf.data.data(), buf.data.size());
+    buf.pos = 0;
+    buf.end = n > 0 ? static_cast<size_t>(n) : 0;
+    if (n <= 0) { return n; }
+  }
+  return static_cast<int>(buf.end - buf.pos);
+}
+
+template <typename T>
+inline int read_buffered(ReadBuffer &buf, char *ptr, size_t size, T read) {
+  // Reads as large as the buffer gain nothing from going through it.
+  if (buf.empty() && size >= CPPHTTPLIB_RECV_BUFSIZ) { return read(ptr, size); }
+
+  auto avail = fill_buffer(buf, read);
+  if (avail <= 0) { return avail; }
+
+  auto n = std::min(size, static_cast<size_t>(avail));
+  memcpy(ptr, buf.data.data() + buf.pos, n);
+  buf.pos += n;
+  return static_cast<int>(n);
+}
+
+template <typename T>
+inline int read_line_buffered(ReadBuffer &buf, char *ptr, size_t size,
+                              T read) {
+  auto avail = fill_buffer(buf, read);
+  if (avail <= 0) { return avail; }
+
+  auto p = buf.data.data() + buf.pos;
+  auto n = std::min(size, static_cast<size_t>(avail));
+  auto lf = static_cast<const char *>(memchr(p, '\n', n));
+  if (lf) { n = static_cast<size_t>(lf - p) + 1; }
+
+  memcpy(ptr, p, n);
+  buf.pos += n;
+  return static_cast<int>(n);
+}
+
+template <typename T>
+inline int consume_buffered(ReadBuffer &buf, const BufferConsumer &consumer,
+                            T read) {
+  auto avail = fill_buffer(buf, read);
+  if (avail <= 0) { return avail; }
+
+  auto n = std::min(consumer(buf.data.data() + buf.pos,
+                             static_cast<size_t>(avail)),
+                    static_cast<size_t>(avail));
+  buf.pos += n;
+  return static_cast<int>(n);
+}
+
+// Each call of `write` is given at most INT_MAX bytes, as the socket and TLS
+// writes return the count as an `int`.
+template <typename T>
+inline bool write_all(const char *ptr, size_t size, T write) {
+  const size_t max_size = std::numeric_limits<int>::max();
+  while (size > 0) {
+    auto n = write(ptr, std::min(size, max_size));
+    if (n <= 0) { return false; }
+    ptr += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+inline size_t total_size(const IoVec *vec, size_t count) {
+  size_t size = 0;
+  for (size_t i = 0; i < count; i++) {
+    size += vec[i].size;
+  }
+  return size;
+}
+
+// Writes all the pieces with `writev`, which may write only the first few
+// of them, or part of one.
+template <typename T>
+inline bool writev_all(IoVec *vec, size_t count, T writev) {
+  for (;;) {
+    while (count > 0 && vec->size == 0) {
+      vec++;
+      count--;
+    }
+    if (count == 0) { return true; }
+
+    auto n = writev(vec, count);
+    if (n <= 0) { return false; }
+
+    auto rest = static_cast<size_t>(n);
+    while (rest > 0 && rest >= vec->size) {
+      rest -= vec->size;
+      vec++;
+      count--;
+    }
+    if (rest > 0) {
+      vec->data += rest;
+      vec->size -= rest;
+    }
+  }
+}
+
+// Appends the pieces to `buf` and writes it out whenever it fills up, so
+// small pieces leave together. What does not fit is written directly once
+// the buffer has been topped up with its head, so `write` sees few large
+// writes; over TLS that means few SSL_write calls and full records.
+template <typename T>
+inline bool write_coalesced(std::string &buf, const IoVec *vec, size_t count,
+                            T write) {
+  for (size_t i = 0; i < count; i++) {
+    auto ptr = vec[i].data;
+    auto size = vec[i].size;
+    if (buf.size() + size > CPPHTTPLIB_SEND_BUFSIZ) {
+      auto n = CPPHTTPLIB_SEND_BUFSIZ - buf.size();
+      buf.append(ptr, n);
+      ptr += n;
+      size -= n;
+      auto ret = write_all(buf.data(), buf.size(), write);
+      buf.clear();
+      if (!ret) { return false; }
+      if (size >= CPPHTTPLIB_SEND_BUFSIZ) {
+        if (!write_all(ptr, size, write)) { return false; }
+        continue;
+      }
+    }
+    buf.append(ptr, size);
+  }
+  return true;
+}
+
+template <typename T> inline bool flush_buffered(Connection &conn, T write) {
+  auto ret = write_all(conn.write_buf.data(), conn.write_buf.size(), write);
+  conn.write_buf.clear();
+  return ret;
+}
+
+template <typename T>
+inline int write_buffered(Connection &conn, const char *ptr, size_t size,
+                          T write) {
+  if (conn.write_buf.size() + size > CPPHTTPLIB_SEND_BUFSIZ) {
+    if (!flush_buffered(conn, write)) { return -1; }
+    if (size >= CPPHTTPLIB_SEND_BUFSIZ) {
+      return write_all(ptr, size, write) ? static_cast<int>(size) : -1;
+    }
+  }
+  conn.write_buf.append(ptr, size);
+  return static_cast<int>(size);
+}
+
+// Arms the deadline of `stage` for the connection, replacing the previous one.
+// Without a wheel (or with a zero timeout) the connection is not supervised.
+// The wheel applies the change on its next tick.
+inline void set_stage(Connection *conn, Stage stage) {
+  if (!conn || !conn->wheel) { return; }
+
+  const Timeout *timeout = nullptr;
+  switch (stage) {
+  case Stage::Idle: timeout = &conn->timeouts->keep_alive; break;
+  case Stage::Handshake: timeout = &conn->timeouts->handshake; break;
+  case Stage::Header: timeout = &conn->timeouts->header; break;
+  case Stage::Body: timeout = &conn->timeouts->body; break;
+  case Stage::Write: timeout = &conn->timeouts->write; break;
+  case Stage::None: break;
+  }
+
+  conn->stage = static_cast<int>(stage);
+  conn->supervised = timeout && !timeout->is_zero();
+  if (!conn->supervised) {
+    conn->wheel->unschedule(conn->timer);
+    return;
+  }
+
+  conn->progress_mark = conn->progress.load();
+  conn->wheel->schedule(conn->timer, *timeout);
+}
+
+// Disarms the deadline right away rather than on the next tick, so the wheel
+// can't shut the socket down once it is closed and its descriptor reused.
+inline void cancel_deadline(Connection &conn) {
+  if (!conn.wheel) { return; }
+  conn.wheel->cancel(conn.timer);
+  conn.stage = static_cast<int>(Stage::None);
+  conn.supervised = false;
+}
+
+// Expiry handler for connection deadlines. Shutting the socket down wakes up
+// whichever thread is blocked on it, and the connection is then closed by its
+// owner like any other failed connection.
+inline bool expire_connection(TimerNode &node) {
+  auto conn = static_cast<Connection *>(node.data);
+  auto stage = static_cast<Stage>(conn->stage.load());
+
+  if (stage == Stage::Body || stage == Stage::Write) {
+    auto progress = conn->progress.load();
+    if (progress != conn->progress_mark) {
+      conn->progress_mark = progress;
+      return true;
+    }
+  }
+
+  shutdown_socket(conn->sock);
+  return false;
+}
+
+#ifdef CPPHTTPLIB_EPOLL_SUPPORT
+// NOTE: a loop owns every connection it has adopted, so the epoll set and the
+// connection table are only touched from the thread running `run`. Other
+// threads hand over sockets through `add` and `resume`, which are the only
+// locked paths.
+//
+// The loop never reads a request itself, as it would run over blocking
+// sockets and a client sending slowly would stall every other connection of
+// the loop. It only parks idle connections: a readable one is disarmed,
+// handed to a worker of `pool` and armed again when the worker is done.
+//
+// Parked connections sit in the idle stage of `wheel`; when their keep-alive
+// deadline passes the socket is shut down, reported readable and closed.
+class EventLoop {
+public:
+  typedef std::function<bool(Connection &)> ReadHandler;
+  typedef std::function<void(Connection &)> CloseHandler;
+
+  EventLoop(size_t keep_alive_max_count, TimerWheel *wheel,
+            const StageTimeouts *timeouts, ReadHandler on_read,
+            CloseHandler on_close, ThreadPool &pool, bool block_when_full,
+            CloseHandler on_reject)
+      : keep_alive_max_count_(keep_alive_max_count), wheel_(wheel),
+        timeouts_(timeouts), on_read_(on_read), on_close_(on_close),
+        pool_(pool), block_when_full_(block_when_full), on_reject_(on_reject),
+        dispatching_(true), stopped_(false) {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    evfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (epfd_ != -1 && evfd_ != -1) {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.ptr = nullptr;
+      epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_, &ev);
+    }
+  }
+
+  ~EventLoop() {
+    if (epfd_ != -1) { ::close(epfd_); }
+    if (evfd_ != -1) { ::close(evfd_); }
+  }
+
+  bool is_valid() const { return epfd_ != -1 && evfd_ != -1; }
+
+  void add(socket_t sock) {
+    {
+      std::lock_guard<std::mutex> guard(pending_mutex_);
+      pending_.push_back(sock);
+    }
+    wakeup();
+  }
+
+  // From now on a connection that turns readable is closed, not handed to
+  // the pool, so the pool can be shut down while the loop still runs.
+  void stop_dispatching() { dispatching_ = false; }
+
+  void stop() {
+    stopped_ = true;
+    wakeup();
+  }
+
+  void run() {
+    struct epoll_event events[CPPHTTPLIB_EPOLL_MAX_EVENTS];
+
+    while (!stopped_) {
+      auto n = epoll_wait(epfd_, events, CPPHTTPLIB_EPOLL_MAX_EVENTS, 100);
+
+      for (auto i = 0; i < n; i++) {
+        auto conn = static_cast<Connection *>(events[i].data.ptr);
+        if (!conn) {
+          uint64_t val;
+          while (::read(evfd_, &val, sizeof(val)) > 0) {}
+          adopt_pending();
+          continue;
+        }
+
+        dispatch(conn);
+      }
+    }
+
+    adopt_pending();
+    while (!conns_.empty()) {
+      close(conns_.begin()->second.get());
+    }
+  }
+
+private:
+  struct Resumed {
+    Connection *conn;
+    bool keep;
+  };
+
+  void wakeup() {
+    uint64_t one = 1;
+    if (::write(evfd_, &one, sizeof(one)) < 0) {
+      ; // The counter is already non-zero, so the loop will wake up anyway.
+    }
+  }
+
+  void dispatch(Connection *conn) {
+    if (!dispatching_) {
+      close(conn);
+      return;
+    }
+
+    auto ok = pool_.enqueue(
+        [this, conn]() {
+          auto keep = on_read_(*conn);
+          {
+            std::lock_guard<std::mutex> guard(pending_mutex_);
+            resumed_.push_back(Resumed{conn, keep});
+          }
+          wakeup();
+        },
+        block_when_full_);
+
+    if (!ok) {
+      epoll_ctl(epfd_, EPOLL_CTL_DEL, conn->sock, nullptr);
+      on_reject_(*conn);
+      conns_.erase(conn->sock);
+    }
+  }
+
+  void adopt_pending() {
+    std::vector<socket_t> socks;
+    std::vector<Resumed> resumed;
+    {
+      std::lock_guard<std::mutex> guard(pending_mutex_);
+      socks.swap(pending_);
+      resumed.swap(resumed_);
+    }
+
+    for (auto sock : socks) {
+      std::unique_ptr<Connection> conn(new Connection());
+      conn->sock = sock;
+      conn->keep_alive_count = keep_alive_max_count_;
+      conn->wheel = wheel_;
+      conn->timeouts = timeouts_;
+
+      struct epoll_event ev;
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = conn.get();
+      if (epoll_ctl(epfd_, EPOLL_CTL_ADD, sock, &ev) == -1) {
+        on_close_(*conn);
+        continue;
+      }
+
+      set_stage(conn.get(), Stage::Idle);
+      conns_[sock] = std::move(conn);
+    }
+
+    for (const auto &x : resumed) {
+      auto conn = x.conn;
+
+      struct epoll_event ev;
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = conn;
+      if (x.keep && dispatching_ &&
+          epoll_ctl(epfd_, EPOLL_CTL_MOD, conn->sock, &ev) == 0) {
+        set_stage(conn, Stage::Idle);
+      } else {
+        close(conn);
+      }
+    }
+  }
+
+  void close(Connection *conn) {
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, conn->sock, nullptr);
+    on_close_(*conn);
+    conns_.erase(conn->sock);
+  }
+
+  const size_t keep_alive_max_count_;
+  TimerWheel *wheel_;
+  const StageTimeouts *timeouts_;
+  ReadHandler on_read_;
+  CloseHandler on_close_;
+  ThreadPool &pool_;
+  const bool block_when_full_;
+  CloseHandler on_reject_;
+  int epfd_;
+  int evfd_;
+  std::atomic<bool> dispatching_;
+  std::atomic<bool> stopped_;
+  std::mutex pending_mutex_;
+  std::vector<socket_t> pending_;
+  std::vector<Resumed> resumed_;
+  std::unordered_map<socket_t, std::unique_ptr<Connection>> conns_;
+};
+#endif
+
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+struct IoUringCounters {
+  std::atomic<uint64_t> operations;
+  std::atomic<uint64_t> syscalls;
+  std::atomic<uint64_t> syscalls_saved;
+};
+
+inline IoUringCounters &io_uring_counters() {
+  static IoUringCounters counters{{0}, {0}, {0}};
+  return counters;
+}
+
+// Minimal io_uring driver on raw syscalls. Every call submits one operation,
+// optionally linked to a timeout, and waits for its completion with a single
+// io_uring_enter. A ring is meant to be used from one thread only.
+//
+// Each operation is tagged with its own user_data, so a completion is never
+// taken for another operation's. A ring whose kernel lacks one of the
+// opcodes used here is left invalid, and callers use plain syscalls; so is
+// one that could not stop an operation after a failed io_uring_enter.
+class IoUring {
+public:
+  explicit IoUring(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) { return; }
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    single_mmap_ = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap_) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap_ ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+    if (!sq_ring_ || !cq_ring_ || !sqes_) {
+      release();
+      return;
+    }
+
+    auto sq = static_cast<char *>(sq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+
+    auto cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    if (!supports_opcodes()) {
+      release();
+      return;
+    }
+
+    // Small reads go through a registered buffer, which saves the kernel
+    // from pinning the user pages on every operation.
+    struct iovec iov;
+    iov.iov_base = fixed_buf_;
+    iov.iov_len = sizeof(fixed_buf_);
+    has_fixed_buf_ = syscall(__NR_io_uring_register, fd_,
+                             IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+  }
+
+  ~IoUring() { release(); }
+
+  bool is_valid() const { return fd_ >= 0; }
+
+  // A null timeout waits until data arrives or the socket is shut down.
+  int recv(socket_t sock, char *ptr, size_t size, const Timeout *timeout) {
+    if (!is_valid()) { return -1; }
+    if (has_fixed_buf_ && size <= sizeof(fixed_buf_)) {
+      auto sqe = prepare(IORING_OP_READ_FIXED, sock, fixed_buf_, size);
+      sqe->buf_index = 0;
+      auto n = submit_and_wait(timeout);
+      if (n > 0) { memcpy(ptr, fixed_buf_, static_cast<size_t>(n)); }
+      return n < 0 ? -1 : n;
+    }
+
+    prepare(IORING_OP_RECV, sock, ptr, size);
+    auto n = submit_and_wait(timeout);
+    return n < 0 ? -1 : n;
+  }
+
+  int send(socket_t sock, const char *ptr, size_t size) {
+    if (!is_valid()) { return -1; }
+    prepare(IORING_OP_SEND, sock, const_cast<char *>(ptr), size);
+    auto n = submit_and_wait(nullptr);
+    return n < 0 ? -1 : n;
+  }
+
+  int sendmsg(socket_t sock, const struct msghdr *msg) {
+    if (!is_valid()) { return -1; }
+    prepare(IORING_OP_SENDMSG, sock, const_cast<struct msghdr *>(msg), 1);
+    auto n = submit_and_wait(nullptr);
+    return n < 0 ? -1 : n;
+  }
+
+  // Returns the accepted socket, -ECANCELED on timeout or another negative
+  // errno value on failure.
+  int accept(socket_t sock, const Timeout &timeout) {
+    if (!is_valid()) { return -EBADF; }
+    auto sqe = prepare(IORING_OP_ACCEPT, sock, nullptr, 0);
+    sqe->accept_flags = SOCK_CLOEXEC;
+    return submit_and_wait(&timeout);
+  }
+
+private:
+  void *map(size_t size, off_t offset) {
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  void release() {
+    if (sqes_) { munmap(sqes_, sqes_size_); }
+    if (cq_ring_ && cq_ring_ != sq_ring_) { munmap(cq_ring_, cq_ring_size_); }
+    if (sq_ring_) { munmap(sq_ring_, sq_ring_size_); }
+    if (fd_ >= 0) { ::close(fd_); }
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = nullptr;
+    fd_ = -1;
+  }
+
+  bool supports_opcodes() {
+    const unsigned count = 256;
+    std::vector<char> buf(sizeof(io_uring_probe) +
+                          count * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe *>(&buf[0]);
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe,
+                count) < 0) {
+      return false;
+    }
+
+    const uint8_t opcodes[] = {IORING_OP_READ_FIXED,    IORING_OP_RECV,
+                               IORING_OP_SEND,          IORING_OP_SENDMSG,
+                               IORING_OP_ACCEPT,        IORING_OP_LINK_TIMEOUT,
+                               IORING_OP_ASYNC_CANCEL};
+    for (auto op : opcodes) {
+      if (op > probe->last_op ||
+          !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  io_uring_sqe *prepare(uint8_t opcode, socket_t sock, void *addr,
+                        size_t len) {
+    op_pos_ = *sq_tail_ + pending_;
+    auto sqe = next_sqe();
+    sqe->opcode = opcode;
+    sqe->fd = sock;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->len = static_cast<uint32_t>(len);
+    // Zero is left to the entries whose completion nobody waits for.
+    if (++op_id_ == 0) { op_id_ = 1; }
+    sqe->user_data = op_id_;
+    return sqe;
+  }
+
+  io_uring_sqe *next_sqe() {
+    auto tail = *sq_tail_ + pending_;
+    auto idx = tail & sq_mask_;
+    auto sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    pending_++;
+    return sqe;
+  }
+
+  // Returns the result of the first prepared operation: a negative errno
+  // value on failure, -ECANCELED when the linked timeout expired or when
+  // io_uring_enter failed before the operation could complete.
+  int submit_and_wait(const Timeout *timeout) {
+    struct __kernel_timespec ts;
+    if (timeout) {
+      sqes_[(*sq_tail_ + pending_ - 1) & sq_mask_].flags |= IOSQE_IO_LINK;
+      ts.tv_sec = timeout->sec;
+      ts.tv_nsec = static_cast<long long>(timeout->usec) * 1000;
+      auto sqe = next_sqe();
+      sqe->opcode = IORING_OP_LINK_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(&ts);
+      sqe->len = 1;
+      sqe->user_data = 0;
+    }
+
+    __atomic_store_n(sq_tail_, *sq_tail_ + pending_, __ATOMIC_RELEASE);
+    pending_ = 0;
+
+    auto &counters = io_uring_counters();
+    counters.operations++;
+    if (timeout) { counters.syscalls_saved++; }
+
+    auto id = op_id_;
+    int ret;
+    auto err = wait_for(id, ret);
+    if (!err) { return ret; }
+
+    // Entries the kernel hasn't taken yet become no-ops. The operation may
+    // already be running on the caller's buffers though, so it is cancelled
+    // and its completion awaited before returning.
+    auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    auto taken = static_cast<int>(head - op_pos_) > 0;
+    for (auto pos = head; pos != *sq_tail_; pos++) {
+      auto &sqe = sqes_[sq_array_[pos & sq_mask_]];
+      sqe.opcode = IORING_OP_NOP;
+      sqe.flags = 0;
+      sqe.user_data = 0;
+    }
+
+    ret = -ECANCELED;
+    if (taken) {
+      auto sqe = next_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = id;
+      sqe->user_data = 0;
+      __atomic_store_n(sq_tail_, *sq_tail_ + pending_, __ATOMIC_RELEASE);
+      pending_ = 0;
+
+      int e;
+      while ((e = wait_for(id, ret)) == EAGAIN || e == EBUSY) {}
+      if (e) {
+        err = e;
+        ret = -ECANCELED;
+      }
+    }
+
+    // Past a momentary shortage the ring is of no further use, and closing
+    // it is the only way left to stop an operation that couldn't be
+    // cancelled.
+    if (err != EAGAIN && err != EBUSY) { release(); }
+
+    return ret;
+  }
+
+  // Submits what is queued and reaps completions until the one of `id`
+  // arrives, skipping those of abandoned operations. Returns 0 with its
+  // result in `res`, or the errno value of a failed io_uring_enter.
+  int wait_for(uint64_t id, int &res) {
+    auto &counters = io_uring_counters();
+    for (;;) {
+      auto head = *cq_head_;
+      auto done = false;
+      while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        auto &cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == id) {
+          res = cqe.res;
+          done = true;
+        }
+        head++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      if (done) { return 0; }
+
+      auto to_submit =
+          *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+      counters.syscalls++;
+      auto r = syscall(__NR_io_uring_enter, fd_, to_submit, 1,
+                       IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r < 0 && errno != EINTR) { return errno; }
+    }
+  }
+
+  int fd_ = -1;
+  bool single_mmap_ = false;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+  unsigned pending_ = 0;
+  unsigned op_pos_ = 0;
+  uint64_t op_id_ = 0;
+  bool has_fixed_buf_ = false;
+  char fixed_buf_[CPPHTTPLIB_RECV_BUFSIZ];
+};
+
+// Returns the calling thread's ring, or nullptr when the kernel doesn't
+// support io_uring (or it is disabled by seccomp).
+inline IoUring *thread_io_uring() {
+  static thread_local IoUring ring(CPPHTTPLIB_IO_URING_ENTRIES);
+  return ring.is_valid() ? &ring : nullptr;
+}
+#endif
+
 template <typename Fn>
 socket_t create_socket(const char *host, int port, Fn fn,
                        int socket_flags = 0) {
@@ -836,6 +3037,41 @@ inline void set_nonblocking(socket_t sock, bool nonblocking) {
 #endif
 }
 
+inline int socket_error() {
+#ifdef _WIN32
+  return WSAGetLastError();
+#else
+  return errno;
+#endif
+}
+
+inline bool is_resource_error(int err) {
+#ifdef _WIN32
+  return err == WSAEMFILE || err == WSAENOBUFS;
+#else
+  return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+#endif
+}
+
+// Errors of 'accept' that only concern the connection being accepted or a
+// momentary lack of resources. The server socket itself is still usable.
+inline bool is_transient_accept_error(int err) {
+  if (is_resource_error(err)) { return true; }
+#ifdef _WIN32
+  return err == WSAEINTR || err == WSAEWOULDBLOCK || err == WSAECONNRESET;
+#else
+  return err == EINTR || err == EAGAIN || err == EWOULDBLOCK ||
+         err == ECONNABORTED || err == EPROTO || err == EPERM;
+#endif
+}
+
+// Share of `total` for part `index` of `parts`: the remainder goes to the
+// first parts, and no part gets less than one.
+inline size_t split_count(size_t total, size_t parts, size_t index) {
+  auto n = total / parts + (index < total % parts ? 1 : 0);
+  return n > 0 ? n : 1;
+}
+
 inline bool is_connection_error() {
 #ifdef _WIN32
   return WSAGetLastError() != WSAEWOULDBLOCK;
@@ -905,6 +3141,7 @@ inline const char *status_message(int status) {
     case 413: return "Payload Too Large";
     case 414: return "Request-URI Too Long";
     case 415: return "Unsupported Media Type";
+    case 503: return "Service Unavailable";
     default:
     case 500: return "Internal Server Error";
   }
@@ -1017,8 +3254,7 @@ inline bool has_header(const Headers &headers, const char *key) {
 
 inline const char *get_header_value(const Headers &headers, const char *key,
                                     size_t id = 0, const char *def = nullptr) {
-  auto it = headers.find(key);
-  std::advance(it, id);
+  auto it = headers.find(key, id);
   if (it != headers.end()) { return it->second.c_str(); }
   return def;
 }
@@ -1032,26 +3268,191 @@ inline uint64_t get_header_value_uint64(const Headers &headers, const char *key,
   return def;
 }
 
-inline bool read_headers(Stream &strm, Headers &headers) {
-  static std::regex re(R"((.+?):\s*(.+?)\s*\r\n)");
+inline bool has_header(const Headers &headers, HeaderId key) {
+  return headers.find(key) != headers.end();
+}
+
+inline const char *get_header_value(const Headers &headers, HeaderId key,
+                                    const char *def = nullptr) {
+  auto it = headers.find(key);
+  if (it != headers.end()) { return it->second.c_str(); }
+  return def;
+}
+
+inline uint64_t get_header_value_uint64(const Headers &headers, HeaderId key,
+                                        int def = 0) {
+  auto it = headers.find(key);
+  if (it != headers.end()) {
+    return std::strtoull(it->second.data(), nullptr, 10);
+  }
+  return def;
+}
+
+inline bool header_value_is(const Headers &headers, HeaderId key,
+                            const char *val) {
+  auto it = headers.find(key);
+  return it != headers.end() && it->second == val;
+}
+
+#ifdef CPPHTTPLIB_SSE2_SUPPORT
+inline int count_trailing_zeros(uint32_t x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return static_cast<int>(i);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+#endif
+
+// Returns the first position in [b, e) holding `c1`, `c2` or `c3`, or `e`.
+inline const char *find_any_of(const char *b, const char *e, char c1, char c2,
+                               char c3) {
+#ifdef CPPHTTPLIB_SSE2_SUPPORT
+#ifdef __AVX2__
+  const auto w1 = _mm256_set1_epi8(c1);
+  const auto w2 = _mm256_set1_epi8(c2);
+  const auto w3 = _mm256_set1_epi8(c3);
+  while (e - b >= 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    auto m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, w1), _mm256_cmpeq_epi8(v, w2)),
+        _mm256_cmpeq_epi8(v, w3));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+    if (mask) { return b + count_trailing_zeros(mask); }
+    b += 32;
+  }
+#endif
+  const auto n1 = _mm_set1_epi8(c1);
+  const auto n2 = _mm_set1_epi8(c2);
+  const auto n3 = _mm_set1_epi8(c3);
+  while (e - b >= 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    auto m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, n1), _mm_cmpeq_epi8(v, n2)),
+        _mm_cmpeq_epi8(v, n3));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+    if (mask) { return b + count_trailing_zeros(mask); }
+    b += 16;
+  }
+#endif
+  while (b < e && *b != c1 && *b != c2 && *b != c3) {
+    b++;
+  }
+  return b;
+}
+
+// RFC 7230 tchar
+inline bool is_token_char(char c) {
+  switch (c) {
+  case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+  case '+': case '-': case '.': case '^': case '_': case '`': case '|':
+  case '~': return true;
+  default:
+    return ('0' <= c && c <= '9') || ('a' <= c && c <= 'z') ||
+           ('A' <= c && c <= 'Z');
+  }
+}
+
+inline bool is_ows(char c) { return c == ' ' || c == '\t'; }
+
+// Parses the header field at `b`, a line ending with CRLF or a bare LF, and
+// sets `next` to the line after it. `lenient` allows whitespace between the
+// name and the colon, as sent by some servers.
+inline bool parse_header_line(const char *b, const char *e, Headers &headers,
+                              bool lenient, const char *&next) {
+  auto colon = find_any_of(b, e, ':', '\r', '\n');
+  if (colon == e || *colon != ':') { return false; }
+
+  auto name_e = colon;
+  if (lenient) {
+    while (name_e > b && is_ows(name_e[-1])) {
+      name_e--;
+    }
+  }
+  if (name_e == b) { return false; }
+  for (auto p = b; p != name_e; p++) {
+    if (!is_token_char(*p)) { return false; }
+  }
+
+  auto val_b = colon + 1;
+  while (val_b < e && is_ows(*val_b)) {
+    val_b++;
+  }
+
+  auto eol = find_any_of(val_b, e, '\r', '\n', '\0');
+  if (eol == e || *eol == '\0') { return false; }
+
+  next = eol + 1;
+  if (*eol == '\r') {
+    if (next == e || *next != '\n') { return false; }
+    next++;
+  }
+
+  auto val_e = eol;
+  while (val_e > val_b && is_ows(val_e[-1])) {
+    val_e--;
+  }
+
+  headers.emplace(b, static_cast<size_t>(name_e - b), val_b,
+                  static_cast<size_t>(val_e - val_b));
+  return true;
+}
+
+// Parses a header block, up to and including the empty line that ends it.
+// Lines may end with CRLF or a bare LF. A field name that isn't a token, or
+// a value holding a bare CR or a NUL, makes the whole block malformed.
+//
+// The client parses responses with `lenient` set. Like the regex it used
+// before, it then skips the lines it can't parse, obs-fold continuation
+// lines included, and keeps the rest.
+inline bool parse_headers(const char *b, const char *e, Headers &headers,
+                          bool lenient = false) {
+  while (b < e) {
+    if (*b == '\n') { return true; }
+    if (*b == '\r') { return b + 1 < e && b[1] == '\n'; }
+
+    const char *next = nullptr;
+    if (!parse_header_line(b, e, headers, lenient, next)) {
+      if (!lenient) { return false; }
+      auto lf = static_cast<const char *>(
+          memchr(b, '\n', static_cast<size_t>(e - b)));
+      if (!lf) { return false; }
+      next = lf + 1;
+    }
+    b = next;
+  }
+
+  return false;
+}
 
+// Collects the header block into `block` first, so it can be scanned in one
+// pass.
+inline bool read_headers(Stream &strm, Headers &headers, std::string &block,
+                         bool lenient = false) {
   const auto bufsiz = 2048;
   char buf[bufsiz];
 
   stream_line_reader reader(strm, buf, bufsiz);
 
+  block.clear();
   for (;;) {
     if (!reader.getline()) { return false; }
-    if (!strcmp(reader.ptr(), "\r\n")) { break; }
-    std::cmatch m;
-    if (std::regex_match(reader.ptr(), m, re)) {
-      auto key = std::string(m[1]);
-      auto val = std::string(m[2]);
-      headers.emplace(key, val);
+    block.append(reader.ptr(), reader.size());
+    if (!strcmp(reader.ptr(), "\r\n") || !strcmp(reader.ptr(), "\n")) {
+      break;
     }
   }
 
-  return true;
+  return parse_headers(block.data(), block.data() + block.size(), headers,
+                       lenient);
+}
+
+inline bool read_headers(Stream &strm, Headers &headers,
+                         bool lenient = false) {
+  std::string block;
+  return read_headers(strm, headers, block, lenient);
 }
 
 template <typename T>
@@ -1102,41 +3503,199 @@ inline bool read_content_without_length(Stream &strm, T callback) {
   return true;
 }
 
-template <typename T>
-inline bool read_content_chunked(Stream &strm, T callback) {
-  const auto bufsiz = 16;
-  char buf[bufsiz];
-
-  stream_line_reader reader(strm, buf, bufsiz);
-
-  if (!reader.getline()) { return false; }
+// Incremental decoder of a chunked message body. The input may be split at
+// any byte, and chunk data is passed to the callback straight out of it.
+// Chunk extensions and trailer fields are checked for length and skipped.
+class ChunkedDecoder {
+public:
+  explicit ChunkedDecoder(uint64_t payload_max_length)
+      : payload_max_length_(payload_max_length) {}
 
-  auto chunk_len = std::stoi(reader.ptr(), 0, 16);
+  bool done() const { return state_ == State::Done; }
+  bool failed() const { return state_ == State::Error; }
+  bool exceeds_payload_max_length() const { return exceeds_; }
 
-  while (chunk_len > 0) {
-    if (!read_content_with_length(strm, chunk_len, nullptr, callback)) {
-      return false;
+  // Decodes up to `size` bytes and returns how many of them belong to the
+  // body. Nothing past the final CRLF is used.
+  template <typename T>
+  size_t decode(const char *data, size_t size, T &callback) {
+    auto p = data;
+    auto e = data + size;
+    while (p < e && !done() && !failed()) {
+      switch (state_) {
+      case State::Size: {
+        auto v = hex_value(*p);
+        if (v < 0) {
+          state_ = digits_ ? State::Extension : State::Error;
+          break;
+        }
+        if (chunk_len_ > ((std::numeric_limits<uint64_t>::max)() >> 4)) {
+          state_ = State::Error;
+          break;
+        }
+        chunk_len_ = (chunk_len_ << 4) | static_cast<uint64_t>(v);
+        digits_++;
+        p++;
+        if (!count_line(1)) { state_ = State::Error; }
+        break;
+      }
+      case State::Extension: {
+        auto c = *p++;
+        if (c == '\r') {
+          state_ = State::SizeLF;
+        } else if (c == '\n') {
+          end_size_line();
+        } else if (c == ';') {
+          extension_ = true;
+        } else if (!extension_ && c != ' ' && c != '\t') {
+          state_ = State::Error;
+        }
+        if (!count_line(1)) { state_ = State::Error; }
+        break;
+      }
+      case State::SizeLF:
+        if (*p++ == '\n') {
+          end_size_line();
+        } else {
+          state_ = State::Error;
+        }
+        break;
+      case State::Data: {
+        auto n = static_cast<size_t>(
+            (std::min)(remaining_, static_cast<uint64_t>(e - p)));
+        callback(p, n);
+        p += n;
+        remaining_ -= n;
+        if (remaining_ == 0) { state_ = State::DataCR; }
+        break;
+      }
+      case State::DataCR: {
+        auto c = *p++;
+        if (c == '\r') {
+          state_ = State::DataLF;
+        } else if (c == '\n') {
+          start_size_line();
+        } else {
+          state_ = State::Error;
+        }
+        break;
+      }
+      case State::DataLF:
+        if (*p++ == '\n') {
+          start_size_line();
+        } else {
+          state_ = State::Error;
+        }
+        break;
+      case State::Trailer: {
+        auto c = *p;
+        if (c == '\r') {
+          p++;
+          state_ = State::TrailerLF;
+        } else if (c == '\n') {
+          p++;
+          state_ = State::Done;
+        } else {
+          state_ = State::TrailerField;
+        }
+        break;
+      }
+      case State::TrailerField: {
+        auto lf = static_cast<const char *>(memchr(p, '\n', e - p));
+        auto n = static_cast<size_t>((lf ? lf + 1 : e) - p);
+        p += n;
+        if (!count_line(n)) {
+          state_ = State::Error;
+        } else if (lf) {
+          state_ = State::Trailer;
+        }
+        break;
+      }
+      case State::TrailerLF:
+        state_ = *p++ == '\n' ? State::Done : State::Error;
+        break;
+      default: break;
+      }
     }
+    return static_cast<size_t>(p - data);
+  }
 
-    if (!reader.getline()) { return false; }
-
-    if (strcmp(reader.ptr(), "\r\n")) { break; }
+private:
+  enum class State {
+    Size,
+    Extension,
+    SizeLF,
+    Data,
+    DataCR,
+    DataLF,
+    Trailer,
+    TrailerField,
+    TrailerLF,
+    Done,
+    Error
+  };
+
+  // Bound on a chunk size line, and on the trailer section as a whole.
+  static const size_t kMaxLineLength = 8192;
+
+  bool count_line(size_t n) {
+    line_len_ += n;
+    return line_len_ <= kMaxLineLength;
+  }
 
-    if (!reader.getline()) { return false; }
+  void start_size_line() {
+    state_ = State::Size;
+    chunk_len_ = 0;
+    digits_ = 0;
+    extension_ = false;
+    line_len_ = 0;
+  }
 
-    chunk_len = std::stoi(reader.ptr(), 0, 16);
+  void end_size_line() {
+    if (chunk_len_ == 0) {
+      state_ = State::Trailer;
+      line_len_ = 0;
+    } else if (chunk_len_ > payload_max_length_ - total_) {
+      state_ = State::Error;
+      exceeds_ = true;
+    } else {
+      state_ = State::Data;
+      remaining_ = chunk_len_;
+      total_ += chunk_len_;
+    }
   }
 
-  if (chunk_len == 0) {
-    // Reader terminator after chunks
-    if (!reader.getline() || strcmp(reader.ptr(), "\r\n")) return false;
+  const uint64_t payload_max_length_;
+  State state_ = State::Size;
+  uint64_t chunk_len_ = 0;
+  uint64_t remaining_ = 0;
+  uint64_t total_ = 0;
+  size_t digits_ = 0;
+  size_t line_len_ = 0;
+  bool extension_ = false;
+  bool exceeds_ = false;
+};
+
+template <typename T>
+inline bool read_content_chunked(Stream &strm, uint64_t payload_max_length,
+                                 bool &exceed_payload_max_length,
+                                 T callback) {
+  ChunkedDecoder decoder(payload_max_length);
+  while (!decoder.done()) {
+    auto n = strm.consume([&](const char *data, size_t size) {
+      return decoder.decode(data, size, callback);
+    });
+    if (decoder.failed()) {
+      exceed_payload_max_length = decoder.exceeds_payload_max_length();
+      return false;
+    }
+    if (n <= 0) { return false; }
   }
-
   return true;
 }
 
 inline bool is_chunked_transfer_encoding(const Headers &headers) {
-  return !strcasecmp(get_header_value(headers, "Transfer-Encoding", 0, ""),
+  return !strcasecmp(get_header_value(headers, HeaderId::TransferEncoding, ""),
                      "chunked");
 }
 
@@ -1154,14 +3713,14 @@ bool read_content(Stream &strm, T &x, uint64_t payload_max_length, int &status,
     return false;
   }
 
-  if (x.get_header_value("Content-Encoding") == "gzip") {
+  if (header_value_is(x.headers, HeaderId::ContentEncoding, "gzip")) {
     out = [&](const char *buf, size_t n) {
       decompressor.decompress(
           buf, n, [&](const char *buf, size_t n) { callback(buf, n); });
     };
   }
 #else
-  if (x.get_header_value("Content-Encoding") == "gzip") {
+  if (header_value_is(x.headers, HeaderId::ContentEncoding, "gzip")) {
     status = 415;
     return false;
   }
@@ -1171,11 +3730,12 @@ bool read_content(Stream &strm, T &x, uint64_t payload_max_length, int &status,
   auto exceed_payload_max_length = false;
 
   if (is_chunked_transfer_encoding(x.headers)) {
-    ret = read_content_chunked(strm, out);
-  } else if (!has_header(x.headers, "Content-Length")) {
+    ret = read_content_chunked(strm, payload_max_length,
+                               exceed_payload_max_length, out);
+  } else if (!has_header(x.headers, HeaderId::ContentLength)) {
     ret = read_content_without_length(strm, out);
   } else {
-    auto len = get_header_value_uint64(x.headers, "Content-Length", 0);
+    auto len = get_header_value_uint64(x.headers, HeaderId::ContentLength, 0);
     if (len > 0) {
       if ((len > payload_max_length) ||
           // For 32-bit platform
@@ -1195,6 +3755,193 @@ bool read_content(Stream &strm, T &x, uint64_t payload_max_length, int &status,
   return ret;
 }
 
+// Serialized "HTTP/1.1 <status> <message>\r\n" lines for the status codes
+// 100 to 599, built once.
+inline const std::string &status_line(int status) {
+  static const std::vector<std::string> lines = [] {
+    std::vector<std::string> v;
+    for (auto i = 100; i < 600; i++) {
+      v.push_back("HTTP/1.1 " + std::to_string(i) + " " + status_message(i) +
+                  "\r\n");
+    }
+    return v;
+  }();
+  return lines[static_cast<size_t>(status - 100)];
+}
+
+inline void append_status_line(std::string &out, int status) {
+  if (100 <= status && status < 600) {
+    out += status_line(status);
+    return;
+  }
+  out += "HTTP/1.1 ";
+  out += std::to_string(status);
+  out += ' ';
+  out += status_message(status);
+  out += "\r\n";
+}
+
+// The current second, published by the server's accept loops as they wake
+// up, which they do at least every 100ms. Zero until a loop has run.
+inline std::atomic<time_t> &date_clock() {
+  static std::atomic<time_t> now{0};
+  return now;
+}
+
+inline void tick_date_clock() {
+  date_clock().store(time(nullptr), std::memory_order_relaxed);
+}
+
+// Formats `t` as an RFC 7231 IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT",
+// into `buf`, which must hold 30 characters, and returns its length.
+inline size_t format_http_date(time_t t, char *buf) {
+  static const char days[] = "SunMonTueWedThuFriSat";
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+  struct tm tm;
+#ifdef _WIN32
+  gmtime_s(&tm, &t);
+#else
+  gmtime_r(&t, &tm);
+#endif
+
+  auto n = snprintf(buf, 30, "%.3s, %02d %.3s %04d %02d:%02d:%02d GMT",
+                    days + 3 * tm.tm_wday, tm.tm_mday, months + 3 * tm.tm_mon,
+                    tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+// Formats "Date: <IMF-fixdate>\r\n" into `buf`, which must hold 40
+// characters, and returns its length.
+inline size_t format_date_field(time_t t, char *buf) {
+  memcpy(buf, "Date: ", 6);
+  auto n = 6 + format_http_date(t, buf + 6);
+  buf[n++] = '\r';
+  buf[n++] = '\n';
+  return n;
+}
+
+// Seconds since the epoch of a UTC calendar date, as timegm is not portable.
+// The day count follows Howard Hinnant's days_from_civil.
+inline time_t utc_time(int year, int mon, int mday, int hour, int min,
+                       int sec) {
+  year -= mon <= 2;
+  auto era = (year >= 0 ? year : year - 399) / 400;
+  auto yoe = year - era * 400;
+  auto doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+  auto doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  auto days = static_cast<long long>(era) * 146097 + doe - 719468;
+  return static_cast<time_t>(days * 86400 + hour * 3600 + min * 60 + sec);
+}
+
+// Parses an HTTP-date in any of the formats RFC 7231 asks recipients to
+// accept: IMF-fixdate, RFC 850 and asctime.
+inline bool parse_http_date(const char *s, time_t &t) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+  char mon[4] = {};
+  int year, mday, hour, min, sec;
+  if (sscanf(s, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &mday, mon, &year, &hour,
+             &min, &sec) == 6) {
+  } else if (sscanf(s, "%*[A-Za-z], %2d-%3s-%2d %2d:%2d:%2d GMT", &mday, mon,
+                    &year, &hour, &min, &sec) == 6) {
+    year += year < 70 ? 2000 : 1900;
+  } else if (sscanf(s, "%*3s %3s %2d %2d:%2d:%2d %4d", mon, &mday, &hour, &min,
+                    &sec, &year) != 6) {
+    return false;
+  }
+
+  auto m = strstr(months, mon);
+  if (strlen(mon) != 3 || !m || (m - months) % 3 || mday < 1 || mday > 31 ||
+      hour > 23 || min > 59 || sec > 60) {
+    return false;
+  }
+  t = utc_time(year, static_cast<int>(m - months) / 3 + 1, mday, hour, min,
+               sec);
+  return true;
+}
+
+// Weak comparison (RFC 7232) of `etag` with an If-None-Match field value.
+inline bool etag_matches(const char *list, const std::string &etag) {
+  auto tag = etag.c_str();
+  if (!strncmp(tag, "W/", 2)) { tag += 2; }
+  auto len = strlen(tag);
+
+  auto p = list;
+  for (;;) {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    if (!*p) { return false; }
+    if (*p == '*') { return true; }
+    if (!strncmp(p, "W/", 2)) { p += 2; }
+    if (*p != '"') { return false; }
+
+    auto e = strchr(p + 1, '"');
+    if (!e) { return false; }
+    if (static_cast<size_t>(e + 1 - p) == len && !memcmp(p, tag, len)) {
+      return true;
+    }
+    p = e + 1;
+  }
+}
+
+// Whether a GET or HEAD for `file` can be answered with 304. If-None-Match
+// takes precedence; If-Modified-Since only counts without it.
+inline bool is_not_modified(const Headers &headers, const File &file) {
+  auto inm = get_header_value(headers, HeaderId::IfNoneMatch);
+  if (inm) { return etag_matches(inm, file.etag); }
+
+  auto ims = get_header_value(headers, HeaderId::IfModifiedSince);
+  time_t t;
+  return ims && parse_http_date(ims, t) && file.mtime <= t;
+}
+
+// Each thread formats the Date field again only when the published second
+// has moved on.
+inline void append_date_field(std::string &out) {
+  struct DateField {
+    time_t sec;
+    size_t size;
+    char buf[40];
+  };
+  static thread_local DateField field = {0, 0, {}};
+
+  auto now = date_clock().load(std::memory_order_relaxed);
+  if (now == 0) { now = time(nullptr); }
+  if (now != field.sec) {
+    field.size = format_date_field(now, field.buf);
+    field.sec = now;
+  }
+  out.append(field.buf, field.size);
+}
+
+// Appends the header fields and the empty line ending them, copying each
+// name and value once into space reserved up front.
+template <typename T>
+inline void append_headers(std::string &out, const T &info) {
+  auto size = out.size() + 2;
+  for (const auto &x : info.headers) {
+    size += x.first.size() + x.second.size() + 4;
+  }
+
+  auto pos = out.size();
+  out.resize(size);
+  auto p = &out[pos];
+  for (const auto &x : info.headers) {
+    memcpy(p, x.first.data(), x.first.size());
+    p += x.first.size();
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, x.second.data(), x.second.size());
+    p += x.second.size();
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+  *p++ = '\r';
+  *p = '\n';
+}
+
 template <typename T> inline void write_headers(Stream &strm, const T &info) {
   for (const auto &x : info.headers) {
     strm.write_format("%s: %s\r\n", x.first.c_str(), x.second.c_str());
@@ -1202,9 +3949,13 @@ template <typename T> inline void write_headers(Stream &strm, const T &info) {
   strm.write("\r\n");
 }
 
+// Each chunk is sent as soon as it is produced, and the head of the response
+// before the first one, so the stream never holds them back.
 template <typename T>
 inline void write_content_chunked(Stream &strm, const T &x) {
-  auto chunked_response = !x.has_header("Content-Length");
+  if (!strm.flush()) { return; }
+
+  auto chunked_response = !has_header(x.headers, HeaderId::ContentLength);
   uint64_t offset = 0;
   auto data_available = true;
   while (data_available) {
@@ -1217,175 +3968,438 @@ inline void write_content_chunked(Stream &strm, const T &x) {
       chunk = from_i_to_hex(chunk.size()) + "\r\n" + chunk + "\r\n";
     }
 
-    if (strm.write(chunk.c_str(), chunk.size()) < 0) {
+    if (strm.write(chunk.c_str(), chunk.size()) < 0 || !strm.flush()) {
       break; // Stop on error
     }
   }
 }
 
+// Returns the first position in [b, e) that encode_url has to escape or that
+// ends the string, or `e`.
+inline const char *find_url_escape(const char *b, const char *e) {
+#ifdef CPPHTTPLIB_SSE2_SUPPORT
+  const auto escaped = url_escaped_chars();
+  __m128i n[8];
+  for (size_t i = 0; i < 8; i++) {
+    n[i] = _mm_set1_epi8(escaped[i]);
+  }
+  const auto zero = _mm_setzero_si128();
+  while (e - b >= 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    // Bytes from 0x80 up already have their top bit set.
+    auto m = _mm_or_si128(v, _mm_cmpeq_epi8(v, zero));
+    for (size_t i = 0; i < 8; i++) {
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(v, n[i]));
+    }
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+    if (mask) { return b + count_trailing_zeros(mask); }
+    b += 16;
+  }
+#endif
+  const auto &tables = url_code_tables();
+  while (b < e && *b && !tables.escape[static_cast<uint8_t>(*b)]) {
+    b++;
+  }
+  return b;
+}
+
 inline std::string encode_url(const std::string &s) {
+  static const char digits[] = "0123456789ABCDEF";
+
   std::string result;
+  result.reserve(s.size());
 
-  for (auto i = 0; s[i]; i++) {
-    switch (s[i]) {
-      case ' ': result += "%20"; break;
-      case '+': result += "%2B"; break;
-      case '\r': result += "%0D"; break;
-      case '\n': result += "%0A"; break;
-      case '\'': result += "%27"; break;
-      case ',': result += "%2C"; break;
-      case ':': result += "%3A"; break;
-      case ';': result += "%3B"; break;
-      default:
-        auto c = static_cast<uint8_t>(s[i]);
-        if (c >= 0x80) {
-          result += '%';
-          char hex[4];
-          size_t len = snprintf(hex, sizeof(hex) - 1, "%02X", c);
-          assert(len == 2);
-          result.append(hex, len);
-        } else {
-          result += s[i];
-        }
-        break;
-    }
+  auto b = s.data();
+  auto e = b + s.size();
+  for (;;) {
+    auto p = find_url_escape(b, e);
+    result.append(b, p);
+    if (p == e || !*p) { break; }
+
+    auto c = static_cast<uint8_t>(*p);
+    const char code[] = {'%', digits[c >> 4], digits[c & 15]};
+    result.append(code, sizeof(code));
+    b = p + 1;
   }
 
   return result;
 }
 
-inline std::string decode_url(const std::string &s) {
-  std::string result;
-
-  for (size_t i = 0; i < s.size(); i++) {
-    if (s[i] == '%' && i + 1 < s.size()) {
-      if (s[i + 1] == 'u') {
-        int val = 0;
-        if (from_hex_to_i(s, i + 2, 4, val)) {
-          // 4 digits Unicode codes
-          char buff[4];
-          size_t len = to_utf8(val, buff);
-          if (len > 0) { result.append(buff, len); }
-          i += 5; // 'u0000'
-        } else {
-          result += s[i];
-        }
+// Decodes [b, e) into `out` and returns the end of the output. `out` may be
+// `b` itself, since the decoded text is never longer than the input.
+inline char *decode_url(const char *b, const char *e, char *out) {
+  while (b < e) {
+    auto p = find_any_of(b, e, '%', '+', '+');
+    if (p != b) {
+      memmove(out, b, static_cast<size_t>(p - b));
+      out += p - b;
+      b = p;
+    }
+    if (b == e) { break; }
+
+    int val = 0;
+    if (*b == '+') {
+      *out++ = ' ';
+      b++;
+    } else if (e - b > 1 && b[1] == 'u') {
+      if (from_hex_to_i(b + 2, e, 4, val)) {
+        // 4 digits Unicode codes
+        char buff[4];
+        auto len = to_utf8(val, buff);
+        memcpy(out, buff, len);
+        out += len;
+        b += 6; // '%u0000'
       } else {
-        int val = 0;
-        if (from_hex_to_i(s, i + 1, 2, val)) {
-          // 2 digits hex codes
-          result += val;
-          i += 2; // '00'
-        } else {
-          result += s[i];
-        }
+        *out++ = *b++;
       }
-    } else if (s[i] == '+') {
-      result += ' ';
+    } else if (from_hex_to_i(b + 1, e, 2, val)) {
+      // 2 digits hex codes
+      *out++ = static_cast<char>(val);
+      b += 3; // '%00'
     } else {
-      result += s[i];
+      *out++ = *b++;
     }
   }
+  return out;
+}
+
+// Decodes [b, e) into `out`, reusing the storage it already has.
+inline void decode_url(const char *b, const char *e, std::string &out) {
+  out.resize(static_cast<size_t>(e - b));
+  auto end = decode_url(b, e, &out[0]);
+  out.resize(static_cast<size_t>(end - &out[0]));
+}
+
+// Decodes the `n` bytes at `s` in place and returns the decoded length.
+inline size_t decode_url_in_place(char *s, size_t n) {
+  return static_cast<size_t>(decode_url(s, s + n, s) - s);
+}
 
+inline std::string decode_url(const std::string &s) {
+  std::string result;
+  decode_url(s.data(), s.data() + s.size(), result);
   return result;
 }
 
-inline void parse_query_text(const std::string &s, Params &params) {
-  split(&s[0], &s[s.size()], '&', [&](const char *b, const char *e) {
-    std::string key;
-    std::string val;
+// Calls `fn` with the key and the still encoded value of each pair in
+// `key=value&...` text.
+template <typename Fn>
+inline void split_query_text(const char *b, const char *e, Fn fn) {
+  split(b, e, '&', [&](const char *b, const char *e) {
+    std::pair<const char *, const char *> key(b, b);
+    std::pair<const char *, const char *> val(b, b);
     split(b, e, '=', [&](const char *b, const char *e) {
-      if (key.empty()) {
-        key.assign(b, e);
+      if (key.first == key.second) {
+        key = std::make_pair(b, e);
       } else {
-        val.assign(b, e);
+        val = std::make_pair(b, e);
       }
     });
-    params.emplace(key, decode_url(val));
+    fn(key, val);
   });
 }
 
-inline bool parse_multipart_boundary(const std::string &content_type,
-                                     std::string &boundary) {
-  auto pos = content_type.find("boundary=");
-  if (pos == std::string::npos) { return false; }
-
-  boundary = content_type.substr(pos + 9);
-  return true;
+inline bool query_key_equal(std::pair<const char *, const char *> key,
+                            const char *s, size_t n) {
+  return static_cast<size_t>(key.second - key.first) == n &&
+         !memcmp(key.first, s, n);
 }
 
-inline bool parse_multipart_formdata(const std::string &boundary,
-                                     const std::string &body,
-                                     MultipartFiles &files) {
-  static std::string dash = "--";
-  static std::string crlf = "\r\n";
+// Parts of a request line, as [first, last) ranges into the line buffer.
+struct RequestLine {
+  MethodId method_id;
+  std::pair<const char *, const char *> method;
+  std::pair<const char *, const char *> target;
+  std::pair<const char *, const char *> path;
+  std::pair<const char *, const char *> query;
+  std::pair<const char *, const char *> version;
+};
 
-  static std::regex re_content_type("Content-Type: (.*?)",
-                                    std::regex_constants::icase);
+inline MethodId method_id(const char *s, size_t n) {
+  static const char *methods[] = {"GET",   "HEAD",   "POST",   "PUT",
+                                  "PATCH", "DELETE", "OPTIONS"};
+
+  // The first two characters tell all the methods apart.
+  size_t i;
+  switch (n < 2 ? '\0' : s[0]) {
+  case 'G': i = 0; break;
+  case 'H': i = 1; break;
+  case 'P': i = s[1] == 'O' ? 2 : s[1] == 'U' ? 3 : 4; break;
+  case 'D': i = 5; break;
+  case 'O': i = 6; break;
+  default: return MethodId::Unknown;
+  }
 
-  static std::regex re_content_disposition(
-      "Content-Disposition: form-data; name=\"(.*?)\"(?:; filename=\"(.*?)\")?",
-      std::regex_constants::icase);
+  if (n != strlen(methods[i]) || memcmp(s, methods[i], n)) {
+    return MethodId::Unknown;
+  }
+  return static_cast<MethodId>(i);
+}
 
-  auto dash_boundary = dash + boundary;
+inline bool parse_method(const char *b, const char *e, const char *&method_end,
+                         MethodId &id) {
+  auto p = b;
+  while (p < e && is_token_char(*p)) {
+    p++;
+  }
+  if (p == b || p == e || *p != ' ') { return false; }
 
-  auto pos = body.find(dash_boundary);
-  if (pos != 0) { return false; }
+  method_end = p;
+  id = method_id(b, static_cast<size_t>(p - b));
+  return true;
+}
 
-  pos += dash_boundary.size();
+// Accepts exactly what this regex does:
+//   ([!#$%&'*+\-.^_`|~0-9A-Za-z]+) (([^?]+)(?:\?(.+?))?)
+//   (HTTP/1\.[01])\r\n
+// That is, the target is everything between the method and the trailing
+// " HTTP/1.x\r\n". The path runs up to the first '?', and the query after it
+// must not be empty or contain a line break.
+inline bool parse_request_line(const char *b, const char *e,
+                               RequestLine &line) {
+  const char *method_end;
+  if (!parse_method(b, e, method_end, line.method_id)) { return false; }
+
+  const size_t suffix_len = 11; // " HTTP/1.x\r\n"
+  auto target_b = method_end + 1;
+  if (static_cast<size_t>(e - target_b) <= suffix_len) { return false; }
+
+  auto target_e = e - suffix_len;
+  if (memcmp(target_e, " HTTP/1.", 8) ||
+      (target_e[8] != '0' && target_e[8] != '1') || target_e[9] != '\r' ||
+      target_e[10] != '\n') {
+    return false;
+  }
 
-  auto next_pos = body.find(crlf, pos);
-  if (next_pos == std::string::npos) { return false; }
+  auto q = static_cast<const char *>(
+      memchr(target_b, '?', static_cast<size_t>(target_e - target_b)));
+  if (q == target_b) { return false; }
+  if (q) {
+    if (q + 1 == target_e) { return false; }
+    for (auto p = q + 1; p != target_e; p++) {
+      if (*p == '\r' || *p == '\n') { return false; }
+    }
+  }
 
-  pos = next_pos + crlf.size();
+  line.method = std::make_pair(b, method_end);
+  line.target = std::make_pair(target_b, target_e);
+  line.path = std::make_pair(target_b, q ? q : target_e);
+  line.query = q ? std::make_pair(q + 1, target_e) : std::make_pair(e, e);
+  line.version = std::make_pair(target_e + 1, e - 2);
+  return true;
+}
 
-  while (pos < body.size()) {
-    next_pos = body.find(crlf, pos);
-    if (next_pos == std::string::npos) { return false; }
+inline bool parse_multipart_boundary(const std::string &content_type,
+                                     std::string &boundary) {
+  auto pos = content_type.find("boundary=");
+  if (pos == std::string::npos) { return false; }
 
-    std::string name;
-    MultipartFile file;
+  boundary = content_type.substr(pos + 9);
+  return true;
+}
 
-    auto header = body.substr(pos, (next_pos - pos));
+// Incremental multipart/form-data parser. The body may arrive in pieces of
+// any size; part data is passed on as it arrives, holding back at most the
+// length of the boundary delimiter when a piece ends in what could be the
+// start of one. Delimiters are found with Boyer-Moore-Horspool.
+class MultipartParser {
+public:
+  explicit MultipartParser(const std::string &boundary)
+      : delimiter_("\r\n--" + boundary) {
+    auto n = delimiter_.size();
+    for (auto &x : skip_) {
+      x = n;
+    }
+    for (size_t i = 0; i + 1 < n; i++) {
+      skip_[static_cast<uint8_t>(delimiter_[i])] = n - 1 - i;
+    }
+  }
 
-    while (pos != next_pos) {
-      std::smatch m;
-      if (std::regex_match(header, m, re_content_type)) {
-        file.content_type = m[1];
-      } else if (std::regex_match(header, m, re_content_disposition)) {
-        name = m[1];
-        file.filename = m[2];
+  // Whether the closing delimiter has been seen.
+  bool is_done() const { return state_ == State::Done; }
+
+  // Feeds the next `n` bytes of the body. `header` is called with each part's
+  // headers and the body offset of its data, and `data` with the data itself.
+  // Returns false once the body turned out to be malformed.
+  template <typename H, typename D>
+  bool parse(const char *b, size_t n, const H &header, const D &data) {
+    auto e = b + n;
+    while (b < e && state_ != State::Done && state_ != State::Error) {
+      switch (state_) {
+      case State::Start: {
+        // The body opens with the delimiter minus its leading CRLF.
+        auto m = std::min(static_cast<size_t>(e - b),
+                          delimiter_.size() - 2 - matched_);
+        if (memcmp(b, delimiter_.data() + 2 + matched_, m)) {
+          state_ = State::Error;
+          break;
+        }
+        advance(b, m);
+        matched_ += m;
+        if (matched_ == delimiter_.size() - 2) {
+          matched_ = 0;
+          state_ = State::Delimiter;
+        }
+        break;
+      }
+      case State::Delimiter: {
+        // Either "--" closes the body, or optional spaces and tabs and a CRLF
+        // end the line and a part follows. `matched_` counts the dashes seen
+        // (0 or 1), or is 2 inside the padding and 3 after the CR.
+        auto c = *b;
+        advance(b, 1);
+        if (c == '-' && matched_ <= 1) {
+          if (matched_++ == 1) { state_ = State::Done; }
+        } else if ((c == ' ' || c == '\t') &&
+                   (matched_ == 0 || matched_ == 2)) {
+          matched_ = 2;
+        } else if (c == '\r' && (matched_ == 0 || matched_ == 2)) {
+          matched_ = 3;
+        } else if (c == '\n' && matched_ == 3) {
+          start_part();
+        } else {
+          state_ = State::Error;
+        }
+        break;
+      }
+      case State::Header: {
+        auto lf = static_cast<const char *>(memchr(b, '\n', e - b));
+        auto end = lf ? lf : e;
+        if (line_.size() + (end - b) > kMaxHeaderLength) {
+          state_ = State::Error;
+          break;
+        }
+        line_.append(b, end);
+        advance(b, end - b);
+        if (!lf) { break; }
+        advance(b, 1);
+        if (!line_.empty() && line_.back() == '\r') { line_.pop_back(); }
+        if (line_.empty()) {
+          file_.offset = static_cast<size_t>(pos_);
+          header(file_);
+          state_ = State::Data;
+        } else {
+          parse_header_line();
+          line_.clear();
+        }
+        break;
+      }
+      case State::Data: b = parse_data(b, e, data); break;
+      default: break;
       }
-
-      pos = next_pos + crlf.size();
-
-      next_pos = body.find(crlf, pos);
-      if (next_pos == std::string::npos) { return false; }
-
-      header = body.substr(pos, (next_pos - pos));
     }
+    return state_ != State::Error;
+  }
 
-    pos = next_pos + crlf.size();
+private:
+  enum class State { Start, Delimiter, Header, Data, Done, Error };
+
+  static const size_t kMaxHeaderLength = 8192;
 
-    next_pos = body.find(crlf + dash_boundary, pos);
+  void advance(const char *&b, size_t n) {
+    b += n;
+    pos_ += n;
+  }
 
-    if (next_pos == std::string::npos) { return false; }
+  void start_part() {
+    file_ = MultipartFile();
+    line_.clear();
+    state_ = State::Header;
+  }
 
-    file.offset = pos;
-    file.length = next_pos - pos;
+  void parse_header_line() {
+    static std::regex re_content_type("Content-Type: (.*?)",
+                                      std::regex_constants::icase);
+
+    static std::regex re_content_disposition(
+        "Content-Disposition: form-data; name=\"(.*?)\"(?:; "
+        "filename=\"(.*?)\")?",
+        std::regex_constants::icase);
+
+    std::smatch m;
+    if (std::regex_match(line_, m, re_content_type)) {
+      file_.content_type = m[1];
+    } else if (std::regex_match(line_, m, re_content_disposition)) {
+      file_.name = m[1];
+      file_.filename = m[2];
+    }
+  }
 
-    pos = next_pos + crlf.size() + dash_boundary.size();
+  // Returns the position of the delimiter in [b, b + n), or n.
+  size_t find_delimiter(const char *b, size_t n) const {
+    auto m = delimiter_.size();
+    size_t i = 0;
+    while (i + m <= n) {
+      auto last = b[i + m - 1];
+      if (last == delimiter_[m - 1] && !memcmp(b + i, delimiter_.data(), m)) {
+        return i;
+      }
+      i += skip_[static_cast<uint8_t>(last)];
+    }
+    return n;
+  }
 
-    next_pos = body.find(crlf, pos);
-    if (next_pos == std::string::npos) { return false; }
+  // Length of the longest end of [b, b + n) the delimiter could start with.
+  size_t partial_delimiter(const char *b, size_t n) const {
+    for (auto k = std::min(n, delimiter_.size() - 1); k > 0; k--) {
+      if (b[n - k] == '\r' && !memcmp(b + n - k, delimiter_.data(), k)) {
+        return k;
+      }
+    }
+    return 0;
+  }
 
-    files.emplace(name, file);
+  template <typename D>
+  const char *parse_data(const char *b, const char *e, const D &data) {
+    auto m = delimiter_.size();
+
+    if (held_.empty()) {
+      auto n = static_cast<size_t>(e - b);
+      auto i = find_delimiter(b, n);
+      if (i < n) {
+        if (i) { data(b, i); }
+        advance(b, i + m);
+        matched_ = 0;
+        state_ = State::Delimiter;
+        return b;
+      }
+      auto k = partial_delimiter(b, n);
+      if (n > k) { data(b, n - k); }
+      held_.assign(e - k, e);
+      advance(b, n);
+      return b;
+    }
 
-    pos = next_pos + crlf.size();
+    // Join the held back bytes with enough new input to decide about them.
+    // The held bytes were already counted in `pos_`.
+    auto old = held_.size();
+    auto take = std::min(static_cast<size_t>(e - b), m);
+    held_.append(b, take);
+    auto i = find_delimiter(held_.data(), held_.size());
+    if (i < held_.size()) {
+      if (i) { data(held_.data(), i); }
+      advance(b, i + m - old);
+      held_.clear();
+      matched_ = 0;
+      state_ = State::Delimiter;
+      return b;
+    }
+    auto k = partial_delimiter(held_.data(), held_.size());
+    if (held_.size() > k) { data(held_.data(), held_.size() - k); }
+    held_.erase(0, held_.size() - k);
+    advance(b, take);
+    return b;
   }
 
-  return true;
-}
+  const std::string delimiter_;
+  size_t skip_[256];
+  State state_ = State::Start;
+  size_t matched_ = 0;
+  uint64_t pos_ = 0;
+  std::string line_;
+  std::string held_;
+  MultipartFile file_;
+};
 
 inline std::string to_lower(const char *beg, const char *end) {
   std::string out;
@@ -1448,9 +4462,16 @@ inline std::string Request::get_header_value(const char *key, size_t id) const {
   return detail::get_header_value(headers, key, id, "");
 }
 
+inline bool Request::has_header(HeaderId key) const {
+  return detail::has_header(headers, key);
+}
+
+inline std::string Request::get_header_value(HeaderId key) const {
+  return detail::get_header_value(headers, key, "");
+}
+
 inline size_t Request::get_header_value_count(const char *key) const {
-  auto r = headers.equal_range(key);
-  return std::distance(r.first, r.second);
+  return headers.count(key);
 }
 
 inline void Request::set_header(const char *key, const char *val) {
@@ -1458,19 +4479,102 @@ inline void Request::set_header(const char *key, const char *val) {
 }
 
 inline bool Request::has_param(const char *key) const {
-  return params.find(key) != params.end();
+  return params.has(key);
 }
 
 inline std::string Request::get_param_value(const char *key, size_t id) const {
-  auto it = params.find(key);
-  std::advance(it, id);
-  if (it != params.end()) { return it->second; }
-  return std::string();
+  return params.value(key, id);
 }
 
 inline size_t Request::get_param_value_count(const char *key) const {
-  auto r = params.equal_range(key);
-  return std::distance(r.first, r.second);
+  return params.value_count(key);
+}
+
+inline bool Request::has_path_param(const char *key) const {
+  for (const auto &x : path_params) {
+    if (x.first == key) { return true; }
+  }
+  return false;
+}
+
+inline std::string Request::get_path_param_value(const char *key) const {
+  for (const auto &x : path_params) {
+    if (x.first == key) { return x.second; }
+  }
+  return std::string();
+}
+
+// Params implementation
+inline void Params::add_query_text(const char *b, const char *e) {
+  if (b == e) { return; }
+  if (!text_.empty()) { text_ += '&'; }
+  text_.append(b, e);
+}
+
+inline bool Params::has(const char *key) const {
+  if (map_.find(key) != map_.end()) { return true; }
+
+  auto n = strlen(key);
+  auto ret = false;
+  detail::split_query_text(
+      text_.data(), text_.data() + text_.size(),
+      [&](std::pair<const char *, const char *> k,
+          std::pair<const char *, const char *>) {
+        if (detail::query_key_equal(k, key, n)) { ret = true; }
+      });
+  return ret;
+}
+
+inline std::string Params::value(const char *key, size_t id) const {
+  auto r = map_.equal_range(key);
+  for (auto it = r.first; it != r.second; ++it) {
+    if (id-- == 0) { return it->second; }
+  }
+
+  auto n = strlen(key);
+  std::string ret;
+  auto found = false;
+  detail::split_query_text(
+      text_.data(), text_.data() + text_.size(),
+      [&](std::pair<const char *, const char *> k,
+          std::pair<const char *, const char *> v) {
+        if (!found && detail::query_key_equal(k, key, n) && id-- == 0) {
+          detail::decode_url(v.first, v.second, ret);
+          found = true;
+        }
+      });
+  return ret;
+}
+
+inline size_t Params::value_count(const char *key) const {
+  auto ret = map_.count(key);
+
+  auto n = strlen(key);
+  detail::split_query_text(
+      text_.data(), text_.data() + text_.size(),
+      [&](std::pair<const char *, const char *> k,
+          std::pair<const char *, const char *>) {
+        if (detail::query_key_equal(k, key, n)) { ret++; }
+      });
+  return ret;
+}
+
+// Moves the pending text into the map. Called from const accessors, so it
+// is the one place that writes through the mutable members; see the thread
+// safety note on the class.
+inline Params::map_type &Params::map() const {
+  if (!text_.empty()) {
+    detail::split_query_text(
+        text_.data(), text_.data() + text_.size(),
+        [&](std::pair<const char *, const char *> k,
+            std::pair<const char *, const char *> v) {
+          std::string val;
+          detail::decode_url(v.first, v.second, val);
+          map_.emplace(std::string(k.first, k.second), std::move(val));
+        });
+    text_.clear();
+  }
+  return map_;
 }
 
 inline bool Request::has_file(const char *key) const {
@@ -1493,9 +4597,16 @@ inline std::string Response::get_header_value(const char *key,
   return detail::get_header_value(headers, key, id, "");
 }
 
+inline bool Response::has_header(HeaderId key) const {
+  return detail::has_header(headers, key);
+}
+
+inline std::string Response::get_header_value(HeaderId key) const {
+  return detail::get_header_value(headers, key, "");
+}
+
 inline size_t Response::get_header_value_count(const char *key) const {
-  auto r = headers.equal_range(key);
-  return std::distance(r.first, r.second);
+  return headers.count(key);
 }
 
 inline void Response::set_header(const char *key, const char *val) {
@@ -1519,7 +4630,65 @@ inline void Response::set_content(const std::string &s,
   set_header("Content-Type", content_type);
 }
 
+inline bool Response::set_file_content(const std::string &path,
+                                       const char *content_type) {
+  auto file = detail::open_file(path);
+  if (!file) { return false; }
+  content_file = file;
+  if (content_type) { set_header("Content-Type", content_type); }
+  return true;
+}
+
 // Rstream implementation
+inline int Stream::read_line(char *ptr, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    auto n = read(ptr + i, 1);
+    if (n < 0) { return n; }
+    if (n == 0) { break; }
+    if (ptr[i++] == '\n') { break; }
+  }
+  return static_cast<int>(i);
+}
+
+inline ssize_t Stream::writev(const IoVec *vec, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!detail::write_all(vec[i].data, vec[i].size,
+                           [&](const char *p, size_t n) {
+                             return write(p, n);
+                           })) {
+      return -1;
+    }
+  }
+  return static_cast<ssize_t>(detail::total_size(vec, count));
+}
+
+inline bool Stream::flush() { return true; }
+
+inline bool Stream::write_file(const detail::File &file, uint64_t offset,
+                               uint64_t size) {
+  std::vector<char> buf(static_cast<size_t>(
+      std::min<uint64_t>(size, CPPHTTPLIB_SEND_BUFSIZ)));
+  while (size > 0) {
+    auto n = detail::read_file_at(
+        file, buf.data(),
+        static_cast<size_t>(std::min<uint64_t>(size, buf.size())), offset);
+    if (n <= 0 || write(buf.data(), static_cast<size_t>(n)) < 0) {
+      return false;
+    }
+    offset += static_cast<uint64_t>(n);
+    size -= static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+inline int Stream::consume(BufferConsumer consumer) {
+  char c;
+  auto n = read(&c, 1);
+  if (n <= 0) { return n; }
+  return static_cast<int>(consumer(&c, 1));
+}
+
 template <typename... Args>
 inline void Stream::write_format(const char *fmt, const Args &... args) {
   const auto bufsiz = 2048;
@@ -1550,21 +4719,203 @@ inline void Stream::write_format(const char *fmt, const Args &... args) {
   }
 }
 
+// io_uring statistics
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+inline IoUringStats get_io_uring_stats() {
+  auto &counters = detail::io_uring_counters();
+  IoUringStats stats;
+  stats.operations = counters.operations;
+  stats.syscalls = counters.syscalls;
+  stats.syscalls_saved = counters.syscalls_saved;
+  return stats;
+}
+#endif
+
+// Request storage statistics
+inline RequestStorageStats get_request_storage_stats() {
+  auto &counters = detail::request_storage_counters();
+  RequestStorageStats stats;
+  stats.requests = counters.requests;
+  stats.recycled = counters.recycled;
+  stats.released = counters.released;
+#ifndef _WIN32
+  struct rusage usage;
+  if (!getrusage(RUSAGE_SELF, &usage)) {
+    stats.minor_faults = static_cast<uint64_t>(usage.ru_minflt);
+  }
+#endif
+  return stats;
+}
+
 // Socket stream implementation
-inline SocketStream::SocketStream(socket_t sock) : sock_(sock) {}
+inline SocketStream::SocketStream(socket_t sock, detail::Timeout read_timeout,
+                                  detail::Connection *conn)
+    : sock_(sock), read_timeout_(read_timeout), conn_(conn),
+      read_buf_(conn ? &conn->read_buf : &own_read_buf_) {
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  ring_ = detail::thread_io_uring();
+#endif
+}
 
 inline SocketStream::~SocketStream() {}
 
 inline int SocketStream::read(char *ptr, size_t size) {
-  if (detail::select_read(sock_, CPPHTTPLIB_READ_TIMEOUT_SECOND,
-                          CPPHTTPLIB_READ_TIMEOUT_USECOND) > 0) {
-    return recv(sock_, ptr, static_cast<int>(size), 0);
+  // Nothing will arrive before the peer has seen the responses to the
+  // requests it already sent.
+  if (read_buf_->empty() && !flush()) { return -1; }
+  return detail::read_buffered(
+      *read_buf_, ptr, size,
+      [&](char *p, size_t n) { return read_socket(p, n); });
+}
+
+inline int SocketStream::read_line(char *ptr, size_t size) {
+  if (read_buf_->empty() && !flush()) { return -1; }
+  return detail::read_line_buffered(
+      *read_buf_, ptr, size,
+      [&](char *p, size_t n) { return read_socket(p, n); });
+}
+
+inline int SocketStream::consume(BufferConsumer consumer) {
+  if (read_buf_->empty() && !flush()) { return -1; }
+  return detail::consume_buffered(
+      *read_buf_, consumer,
+      [&](char *p, size_t n) { return read_socket(p, n); });
+}
+
+inline int SocketStream::write(const char *ptr, size_t size) {
+  if (conn_) {
+    return detail::write_buffered(
+        *conn_, ptr, size,
+        [&](const char *p, size_t n) { return write_socket(p, n); });
+  }
+  return write_socket(ptr, size);
+}
+
+inline ssize_t SocketStream::writev(const IoVec *vec, size_t count) {
+  auto total = detail::total_size(vec, count);
+
+  // Small enough to wait for the rest of a pipelined batch.
+  if (conn_ && conn_->write_buf.size() + total <= CPPHTTPLIB_SEND_BUFSIZ) {
+    for (size_t i = 0; i < count; i++) {
+      conn_->write_buf.append(vec[i].data, vec[i].size);
+    }
+    return static_cast<ssize_t>(total);
+  }
+
+  // Output held back so far leaves in the same system call. `writev_all`
+  // advances the pieces as they are written, so they are copied to the
+  // stack, a batch at a time.
+  IoVec pieces[kMaxPieces];
+  size_t n = 0;
+  if (conn_ && !conn_->write_buf.empty()) {
+    pieces[n++] = IoVec{conn_->write_buf.data(), conn_->write_buf.size()};
+  }
+
+  auto ret = true;
+  size_t i = 0;
+  while (ret && (n > 0 || i < count)) {
+    while (i < count && n < kMaxPieces) {
+      pieces[n++] = vec[i++];
+    }
+    ret = detail::writev_all(
+        pieces, n,
+        [&](const IoVec *v, size_t k) { return writev_socket(v, k); });
+    n = 0;
+  }
+  if (conn_) { conn_->write_buf.clear(); }
+  return ret ? static_cast<ssize_t>(total) : -1;
+}
+
+inline bool SocketStream::flush() {
+  return !conn_ || detail::flush_buffered(*conn_, [&](const char *p, size_t n) {
+    return write_socket(p, n);
+  });
+}
+
+inline bool SocketStream::write_file(const detail::File &file,
+                                     uint64_t offset, uint64_t size) {
+#ifdef CPPHTTPLIB_SENDFILE_SUPPORT
+  if (!flush()) { return false; }
+
+  // The kernel copies from the page cache to the socket, so the contents
+  // never pass through user space.
+  auto off = static_cast<off_t>(offset);
+  while (size > 0) {
+    auto n = ::sendfile(sock_, file.fd, &off,
+                        static_cast<size_t>(std::min<uint64_t>(
+                            size, std::numeric_limits<int>::max())));
+    if (n <= 0) { return false; }
+    if (conn_) { conn_->progress++; }
+    size -= static_cast<uint64_t>(n);
+  }
+  return true;
+#else
+  return Stream::write_file(file, offset, size);
+#endif
+}
+
+inline int SocketStream::read_socket(char *ptr, size_t size) {
+  // A connection under a deadline is shut down when the deadline passes, so
+  // it can block in recv without waiting for the socket to be readable.
+  auto supervised = conn_ && conn_->supervised;
+  int n = -1;
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  // One io_uring_enter with a linked timeout replaces select + recv.
+  if (ring_ && ring_->is_valid()) {
+    n = ring_->recv(sock_, ptr, size, supervised ? nullptr : &read_timeout_);
+  } else
+#endif
+  if (supervised || detail::poll_read(sock_, read_timeout_) > 0) {
+    n = recv(sock_, ptr, static_cast<int>(size), 0);
+  }
+  if (n > 0 && conn_) { conn_->progress++; }
+  return n;
+}
+
+inline int SocketStream::write_socket(const char *ptr, size_t size) {
+  int n;
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  if (ring_ && ring_->is_valid()) {
+    n = ring_->send(sock_, ptr, size);
+  } else
+#endif
+  {
+    n = send(sock_, ptr, static_cast<int>(size), 0);
   }
-  return -1;
+  if (n > 0 && conn_) { conn_->progress++; }
+  return n;
 }
 
-inline int SocketStream::write(const char *ptr, size_t size) {
-  return send(sock_, ptr, static_cast<int>(size), 0);
+inline ssize_t SocketStream::writev_socket(const IoVec *vec, size_t count) {
+#ifdef _WIN32
+  return write_socket(vec[0].data,
+                      std::min<size_t>(vec[0].size,
+                                       std::numeric_limits<int>::max()));
+#else
+  struct iovec iov[kMaxPieces];
+  if (count > kMaxPieces) { count = kMaxPieces; }
+  for (size_t i = 0; i < count; i++) {
+    iov[i].iov_base = const_cast<char *>(vec[i].data);
+    iov[i].iov_len = vec[i].size;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  ssize_t n;
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  if (ring_ && ring_->is_valid()) {
+    n = ring_->sendmsg(sock_, &msg);
+  } else
+#endif
+  {
+    n = sendmsg(sock_, &msg, 0);
+  }
+  if (n > 0 && conn_) { conn_->progress++; }
+  return n;
+#endif
 }
 
 inline int SocketStream::write(const char *ptr) {
@@ -1600,44 +4951,96 @@ inline std::string BufferStream::get_remote_addr() const { return ""; }
 inline const std::string &BufferStream::get_buffer() const { return buffer; }
 
 // HTTP server implementation
-inline Server::Server()
+inline Server::Server(ServerMode mode)
     : keep_alive_max_count_(CPPHTTPLIB_KEEPALIVE_MAX_COUNT),
-      payload_max_length_(CPPHTTPLIB_PAYLOAD_MAX_LENGTH), is_running_(false),
-      svr_sock_(INVALID_SOCKET), running_threads_(0) {
+      timeouts_{
+          {CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
+           CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND},
+          {CPPHTTPLIB_READ_TIMEOUT_SECOND, CPPHTTPLIB_READ_TIMEOUT_USECOND},
+          {CPPHTTPLIB_READ_TIMEOUT_SECOND, CPPHTTPLIB_READ_TIMEOUT_USECOND},
+          {CPPHTTPLIB_READ_TIMEOUT_SECOND, CPPHTTPLIB_READ_TIMEOUT_USECOND},
+          {CPPHTTPLIB_WRITE_TIMEOUT_SECOND, CPPHTTPLIB_WRITE_TIMEOUT_USECOND}},
+      payload_max_length_(CPPHTTPLIB_PAYLOAD_MAX_LENGTH), mode_(mode),
+      event_loop_count_(
+          std::max(1u, std::thread::hardware_concurrency())),
+      thread_pool_count_(CPPHTTPLIB_THREAD_POOL_COUNT),
+      thread_pool_queue_max_(CPPHTTPLIB_THREAD_POOL_QUEUE_MAX),
+      queue_full_policy_(QueueFullPolicy::Block),
+      acceptor_count_(std::max(1u, std::thread::hardware_concurrency())),
+      reuse_request_storage_(false), is_running_(false),
+      svr_sock_(INVALID_SOCKET) {
 #ifndef _WIN32
   signal(SIGPIPE, SIG_IGN);
 #endif
 }
 
-inline Server::~Server() {}
+inline Server::~Server() {
+  // Sockets bound for extra acceptors by 'bind_to_any_port' without a
+  // following 'listen_after_bind'.
+  for (auto sock : reuse_port_socks_) {
+    detail::close_socket(sock);
+  }
+  if (!is_running_ && svr_sock_ != INVALID_SOCKET) {
+    detail::close_socket(svr_sock_);
+  }
+}
 
 inline Server &Server::Get(const char *pattern, Handler handler) {
-  get_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Get).add(pattern, std::move(handler));
   return *this;
 }
 
 inline Server &Server::Post(const char *pattern, Handler handler) {
-  post_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Post).add(pattern, std::move(handler));
+  return *this;
+}
+
+inline Server &Server::Post(const char *pattern,
+                            HandlerWithContentReader handler) {
+  handlers_for_content_reader(MethodId::Post)
+      .add(pattern, std::move(handler));
   return *this;
 }
 
 inline Server &Server::Put(const char *pattern, Handler handler) {
-  put_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Put).add(pattern, std::move(handler));
+  return *this;
+}
+
+inline Server &Server::Put(const char *pattern,
+                           HandlerWithContentReader handler) {
+  handlers_for_content_reader(MethodId::Put)
+      .add(pattern, std::move(handler));
   return *this;
 }
 
 inline Server &Server::Patch(const char *pattern, Handler handler) {
-  patch_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Patch).add(pattern, std::move(handler));
+  return *this;
+}
+
+inline Server &Server::Patch(const char *pattern,
+                             HandlerWithContentReader handler) {
+  handlers_for_content_reader(MethodId::Patch)
+      .add(pattern, std::move(handler));
   return *this;
 }
 
 inline Server &Server::Delete(const char *pattern, Handler handler) {
-  delete_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Delete).add(pattern, std::move(handler));
   return *this;
 }
 
 inline Server &Server::Options(const char *pattern, Handler handler) {
-  options_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  handlers(MethodId::Options).add(pattern, std::move(handler));
+  return *this;
+}
+
+inline Server &Server::Route(const char *method, const char *pattern,
+                             Handler handler) {
+  auto id = detail::method_id(method, strlen(method));
+  auto &x = id == MethodId::Unknown ? custom_handlers_[method] : handlers(id);
+  x.add(pattern, std::move(handler));
   return *this;
 }
 
@@ -1659,10 +5062,55 @@ inline void Server::set_keep_alive_max_count(size_t count) {
   keep_alive_max_count_ = count;
 }
 
+inline void Server::set_keep_alive_timeout(time_t sec, time_t usec) {
+  timeouts_.keep_alive = detail::Timeout{sec, usec};
+}
+
+inline void Server::set_handshake_timeout(time_t sec, time_t usec) {
+  timeouts_.handshake = detail::Timeout{sec, usec};
+}
+
+inline void Server::set_header_read_timeout(time_t sec, time_t usec) {
+  timeouts_.header = detail::Timeout{sec, usec};
+}
+
+inline void Server::set_body_read_timeout(time_t sec, time_t usec) {
+  timeouts_.body = detail::Timeout{sec, usec};
+}
+
+inline void Server::set_write_timeout(time_t sec, time_t usec) {
+  timeouts_.write = detail::Timeout{sec, usec};
+}
+
 inline void Server::set_payload_max_length(uint64_t length) {
   payload_max_length_ = length;
 }
 
+inline void Server::set_reuse_request_storage(bool on) {
+  reuse_request_storage_ = on;
+}
+
+inline void Server::set_file_cache(size_t max_count, time_t ttl_sec) {
+  file_cache_.reset(max_count > 0 ? new detail::FileCache(max_count, ttl_sec)
+                                  : nullptr);
+}
+
+inline void Server::set_event_loop_count(size_t count) {
+  event_loop_count_ = count > 0 ? count : 1;
+}
+
+inline void Server::set_thread_pool(size_t count, size_t queue_max,
+                                    QueueFullPolicy policy) {
+  thread_pool_count_ = count > 0 ? count : 1;
+  thread_pool_queue_max_ = queue_max > 0 ? queue_max : 1;
+  queue_full_policy_ = policy;
+}
+
+inline void Server::set_acceptor_count(size_t count) {
+  acceptor_count_ =
+      count > 0 ? count : std::max(1u, std::thread::hardware_concurrency());
+}
+
 inline int Server::bind_to_any_port(const char *host, int socket_flags) {
   return bind_internal(host, 0, socket_flags);
 }
@@ -1677,33 +5125,37 @@ inline bool Server::listen(const char *host, int port, int socket_flags) {
 inline bool Server::is_running() const { return is_running_; }
 
 inline void Server::stop() {
-  if (is_running_) {
-    assert(svr_sock_ != INVALID_SOCKET);
-    std::atomic<socket_t> sock(svr_sock_.exchange(INVALID_SOCKET));
+  if (is_running_) { close_server_socket(); }
+}
+
+inline void Server::close_server_socket() {
+  // Invalidate the socket before closing it, so that no acceptor sees its
+  // descriptor once it may be reused.
+  auto sock = svr_sock_.exchange(INVALID_SOCKET);
+  if (sock != INVALID_SOCKET) {
     detail::shutdown_socket(sock);
     detail::close_socket(sock);
   }
 }
 
 inline bool Server::parse_request_line(const char *s, Request &req) {
-  static std::regex re("(GET|HEAD|POST|PUT|PATCH|DELETE|OPTIONS) "
-                       "(([^?]+)(?:\\?(.+?))?) (HTTP/1\\.[01])\r\n");
-
-  std::cmatch m;
-  if (std::regex_match(s, m, re)) {
-    req.version = std::string(m[5]);
-    req.method = std::string(m[1]);
-    req.target = std::string(m[2]);
-    req.path = detail::decode_url(m[3]);
-
-    // Parse query text
-    auto len = std::distance(m[4].first, m[4].second);
-    if (len > 0) { detail::parse_query_text(m[4], req.params); }
-
-    return true;
+  detail::RequestLine line;
+  if (!detail::parse_request_line(s, s + strlen(s), line)) { return false; }
+
+  req.version.assign(line.version.first, line.version.second);
+  req.method.assign(line.method.first, line.method.second);
+  req.method_id = line.method_id;
+  // Other methods are only taken when there are routes for them.
+  if (req.method_id == MethodId::Unknown &&
+      !custom_handlers_.count(req.method)) {
+    return false;
   }
+  req.target.assign(line.target.first, line.target.second);
+  detail::decode_url(line.path.first, line.path.second, req.path);
 
-  return false;
+  req.params.add_query_text(line.query.first, line.query.second);
+
+  return true;
 }
 
 inline void Server::write_response(Stream &strm, bool last_connection,
@@ -1712,41 +5164,43 @@ inline void Server::write_response(Stream &strm, bool last_connection,
 
   if (400 <= res.status && error_handler_) { error_handler_(req, res); }
 
-  // Response line
-  strm.write_format("HTTP/1.1 %d %s\r\n", res.status,
-                    detail::status_message(res.status));
-
   // Headers
-  if (last_connection || req.get_header_value("Connection") == "close") {
+  if (last_connection ||
+      detail::header_value_is(req.headers, HeaderId::Connection, "close")) {
     res.set_header("Connection", "close");
   }
 
-  if (!last_connection && req.get_header_value("Connection") == "Keep-Alive") {
+  if (!last_connection &&
+      detail::header_value_is(req.headers, HeaderId::Connection,
+                              "Keep-Alive")) {
     res.set_header("Connection", "Keep-Alive");
   }
 
   if (res.body.empty()) {
-    if (!res.has_header("Content-Length")) {
+    if (res.content_file) {
+      auto length = std::to_string(res.content_file->size);
+      res.set_header("Content-Length", length.c_str());
+    } else if (!res.has_header(HeaderId::ContentLength)) {
       if (res.content_producer) {
         // Streamed response
         res.set_header("Transfer-Encoding", "chunked");
-      } else {
+      } else if (res.status != 304) {
         res.set_header("Content-Length", "0");
       }
     }
   } else {
 #ifdef CPPHTTPLIB_ZLIB_SUPPORT
     // TODO: 'Accpet-Encoding' has gzip, not gzip;q=0
-    const auto &encodings = req.get_header_value("Accept-Encoding");
+    const auto &encodings = req.get_header_value(HeaderId::AcceptEncoding);
     if (encodings.find("gzip") != std::string::npos &&
-        detail::can_compress(res.get_header_value("Content-Type"))) {
+        detail::can_compress(res.get_header_value(HeaderId::ContentType))) {
       if (detail::compress(res.body)) {
         res.set_header("Content-Encoding", "gzip");
       }
     }
 #endif
 
-    if (!res.has_header("Content-Type")) {
+    if (!res.has_header(HeaderId::ContentType)) {
       res.set_header("Content-Type", "text/plain");
     }
 
@@ -1754,12 +5208,23 @@ inline void Server::write_response(Stream &strm, bool last_connection,
     res.set_header("Content-Length", length.c_str());
   }
 
-  detail::write_headers(strm, res);
+  // The response line, the headers and the body leave in one write. The
+  // head is serialized into a buffer the thread keeps for its responses.
+  static thread_local std::string head;
+  head.clear();
+  detail::append_status_line(head, res.status);
+  if (!res.has_header(HeaderId::Date)) { detail::append_date_field(head); }
+  detail::append_headers(head, res);
+
+  auto with_body = req.method_id != MethodId::Head;
+  IoVec vec[] = {{head.data(), head.size()},
+                 {res.body.data(), with_body ? res.body.size() : 0}};
+  strm.writev(vec, 2);
 
   // Body
-  if (req.method != "HEAD") {
-    if (!res.body.empty()) {
-      strm.write(res.body.c_str(), res.body.size());
+  if (with_body && res.body.empty()) {
+    if (res.content_file) {
+      strm.write_file(*res.content_file, 0, res.content_file->size);
     } else if (res.content_producer) {
       detail::write_content_chunked(strm, res);
     }
@@ -1775,10 +5240,24 @@ inline bool Server::handle_file_request(Request &req, Response &res) {
 
     if (!path.empty() && path.back() == '/') { path += "index.html"; }
 
-    if (detail::is_file(path)) {
-      detail::read_file(path, res.body);
-      auto type = detail::find_content_type(path);
-      if (type) { res.set_header("Content-Type", type); }
+    // The file is sent from its descriptor as the response goes out.
+    auto file =
+        file_cache_ ? file_cache_->get(path) : detail::open_file(path);
+    if (file) {
+      res.set_header("ETag", file->etag.c_str());
+      res.set_header("Last-Modified", file->last_modified.c_str());
+
+      // A cached copy that is still current is revalidated without sending
+      // the file again.
+      if (detail::is_not_modified(req.headers, *file)) {
+        res.status = 304;
+        return true;
+      }
+
+      res.content_file = file;
+      if (file->content_type) {
+        res.set_header("Content-Type", file->content_type);
+      }
       res.status = 200;
       return true;
     }
@@ -1795,9 +5274,7 @@ inline socket_t Server::create_server_socket(const char *host, int port,
         if (::bind(sock, ai.ai_addr, static_cast<int>(ai.ai_addrlen))) {
           return false;
         }
-        if (::listen(sock, 5)) { // Listen through 5 channels
-          return false;
-        }
+        if (::listen(sock, CPPHTTPLIB_LISTEN_BACKLOG)) { return false; }
         return true;
       },
       socket_flags);
@@ -1817,167 +5294,437 @@ inline int Server::bind_internal(const char *host, int port, int socket_flags) {
       return -1;
     }
     if (address.ss_family == AF_INET) {
-      return ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
+      port = ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
     } else if (address.ss_family == AF_INET6) {
-      return ntohs(
+      port = ntohs(
           reinterpret_cast<struct sockaddr_in6 *>(&address)->sin6_port);
     } else {
       return -1;
     }
-  } else {
-    return port;
   }
+
+#ifdef __linux__
+  // With SO_REUSEPORT the kernel spreads incoming connections over all the
+  // sockets bound to the same address. Other platforms don't balance them,
+  // so they keep a single acceptor. Every acceptor needs a worker of its
+  // own, so there are no more of them than pool workers.
+  auto acceptor_count = std::min(acceptor_count_, thread_pool_count_);
+  for (size_t i = 1; i < acceptor_count; i++) {
+    auto sock = create_server_socket(host, port, socket_flags);
+    if (sock == INVALID_SOCKET) {
+      // Rather than run with fewer acceptors than asked for.
+      for (auto x : reuse_port_socks_) {
+        detail::close_socket(x);
+      }
+      reuse_port_socks_.clear();
+      detail::close_socket(svr_sock_);
+      svr_sock_ = INVALID_SOCKET;
+      return -1;
+    }
+    reuse_port_socks_.push_back(sock);
+  }
+#endif
+
+  return port;
 }
 
 inline bool Server::listen_internal() {
+  is_running_ = true;
+
+  // Each acceptor runs its own accept loop and worker set, so the only
+  // state they share is the primary socket used to signal 'stop'.
+  std::vector<socket_t> socks;
+  socks.swap(reuse_port_socks_);
+
+  auto acceptor_count = socks.size() + 1;
+  std::atomic<bool> failed(false);
+  std::vector<std::thread> acceptors;
+  for (size_t i = 0; i < socks.size(); i++) {
+    auto sock = socks[i];
+    acceptors.emplace_back([=, &failed]() {
+      if (!accept_loop(sock, i + 1, acceptor_count)) { failed = true; }
+    });
+  }
+
+  auto ret = accept_loop(svr_sock_, 0, acceptor_count);
+
+  for (auto &t : acceptors) {
+    t.join();
+  }
+
+  is_running_ = false;
+
+  return ret && !failed;
+}
+
+inline bool Server::accept_loop(socket_t svr_sock, size_t index,
+                                size_t acceptor_count) {
+  auto primary = index == 0;
   auto ret = true;
+  auto block = queue_full_policy_ == QueueFullPolicy::Block;
+
+  // Deadlines of all connections accepted here. The wheel is advanced by
+  // this loop, which wakes up at least every 100ms.
+  detail::TimerWheel wheel(
+      std::chrono::milliseconds(CPPHTTPLIB_TIMER_WHEEL_TICK_MSEC),
+      detail::expire_connection);
+
+  auto pool_count =
+      detail::split_count(thread_pool_count_, acceptor_count, index);
+  std::unique_ptr<detail::ThreadPool> pool(
+      new detail::ThreadPool(pool_count, thread_pool_queue_max_));
+
+#ifdef CPPHTTPLIB_EPOLL_SUPPORT
+  // The loops park the idle keep-alive connections, so a worker is only
+  // taken while a request is being served.
+  std::vector<std::unique_ptr<detail::EventLoop>> loops;
+  std::vector<std::thread> loop_threads;
+
+  auto loop_count =
+      mode_ == ServerMode::ThreadPool
+          ? 1
+          : detail::split_count(event_loop_count_, acceptor_count, index);
+  for (size_t i = 0; i < loop_count; i++) {
+    std::unique_ptr<detail::EventLoop> loop(new detail::EventLoop(
+        keep_alive_max_count_, &wheel, &timeouts_,
+        [this](detail::Connection &conn) { return process_connection(conn); },
+        [this](detail::Connection &conn) { close_connection(conn); }, *pool,
+        block,
+        [this](detail::Connection &conn) { reject_connection(conn); }));
+    if (!loop->is_valid()) {
+      loops.clear();
+      break;
+    }
+    loops.push_back(std::move(loop));
+  }
 
-  is_running_ = true;
+  for (auto &loop : loops) {
+    auto p = loop.get();
+    loop_threads.emplace_back([p]() { p->run(); });
+  }
+
+  size_t next_loop = 0;
+#endif
+
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+  auto ring = detail::thread_io_uring();
+#endif
 
   for (;;) {
+    wheel.advance(std::chrono::steady_clock::now());
+    detail::tick_date_clock();
+
     if (svr_sock_ == INVALID_SOCKET) {
       // The server socket was closed by 'stop' method.
+      if (!primary) { detail::close_socket(svr_sock); }
       break;
     }
 
-    auto val = detail::select_read(svr_sock_, 0, 100000);
+    socket_t sock;
+    int err = 0;
+#ifdef CPPHTTPLIB_IO_URING_SUPPORT
+    if (ring && ring->is_valid()) {
+      auto val = ring->accept(svr_sock, detail::Timeout{0, 100000});
 
-    if (val == 0) { // Timeout
-      continue;
-    }
+      if (val == -ECANCELED) { // Timeout
+        continue;
+      }
+
+      // The ring itself failed; plain accept takes over.
+      if (!ring->is_valid()) { continue; }
+
+      sock = val >= 0 ? val : INVALID_SOCKET;
+      if (val < 0) { err = -val; }
+    } else
+#endif
+    {
+      auto val = detail::poll_read(svr_sock, detail::Timeout{0, 100000});
+
+      if (val == 0) { // Timeout
+        continue;
+      }
 
-    socket_t sock = accept(svr_sock_, nullptr, nullptr);
+      sock = accept(svr_sock, nullptr, nullptr);
+      if (sock == INVALID_SOCKET) { err = detail::socket_error(); }
+    }
 
     if (sock == INVALID_SOCKET) {
-      if (svr_sock_ != INVALID_SOCKET) {
-        detail::close_socket(svr_sock_);
-        ret = false;
-      } else {
-        ; // The server socket was closed by user.
+      if (svr_sock_ == INVALID_SOCKET) {
+        // The server socket was closed by user.
+        if (!primary) { detail::close_socket(svr_sock); }
+        break;
       }
+
+      if (detail::is_transient_accept_error(err)) {
+        // Out of descriptors: the pending connection stays readable, so
+        // back off instead of spinning until some are released.
+        if (detail::is_resource_error(err)) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        continue;
+      }
+
+      // Shut down every acceptor the way 'stop' does; the others notice the
+      // invalid server socket within one poll timeout.
+      ret = false;
+      close_server_socket();
+      if (!primary) { detail::close_socket(svr_sock); }
       break;
     }
 
-    // TODO: Use thread pool...
-    std::thread([=]() {
-      {
-        std::lock_guard<std::mutex> guard(running_threads_mutex_);
-        running_threads_++;
-      }
+#ifdef CPPHTTPLIB_EPOLL_SUPPORT
+    if (!loops.empty()) {
+      loops[next_loop++ % loops.size()]->add(sock);
+      continue;
+    }
+#endif
 
-      read_and_close_socket(sock);
+    auto job = [this, sock, &wheel]() { read_and_close_socket(sock, &wheel); };
+    if (!pool->enqueue(job, block)) {
+      detail::Connection conn;
+      conn.sock = sock;
+      reject_connection(conn);
+    }
+  }
 
-      {
-        std::lock_guard<std::mutex> guard(running_threads_mutex_);
-        running_threads_--;
-      }
-    }).detach();
+  // Workers may still be blocked on connections under a deadline, so keep
+  // the wheel and the Date clock turning until they are done.
+  std::atomic<bool> draining(true);
+  std::thread ticker([&]() {
+    while (draining) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(CPPHTTPLIB_TIMER_WHEEL_TICK_MSEC));
+      wheel.advance(std::chrono::steady_clock::now());
+      detail::tick_date_clock();
+    }
+  });
+
+  // Let the workers finish the requests they already took. The loops stop
+  // handing them connections first, so a parked connection turning readable
+  // now is closed rather than rejected with a 503 for a request never read.
+  // Connections the workers hand back are closed by their loop too.
+#ifdef CPPHTTPLIB_EPOLL_SUPPORT
+  for (auto &loop : loops) {
+    loop->stop_dispatching();
   }
+#endif
 
-  // TODO: Use thread pool...
-  for (;;) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    std::lock_guard<std::mutex> guard(running_threads_mutex_);
-    if (!running_threads_) { break; }
+  pool->shutdown();
+
+#ifdef CPPHTTPLIB_EPOLL_SUPPORT
+  for (auto &loop : loops) {
+    loop->stop();
+  }
+  for (auto &t : loop_threads) {
+    t.join();
   }
+#endif
 
-  is_running_ = false;
+  draining = false;
+  ticker.join();
 
   return ret;
 }
 
+inline Server::Handlers &Server::handlers(MethodId method) {
+  return handlers_[static_cast<size_t>(method)];
+}
+
+inline Server::HandlersForContentReader &
+Server::handlers_for_content_reader(MethodId method) {
+  return handlers_for_content_reader_[static_cast<size_t>(method)];
+}
+
 inline bool Server::routing(Request &req, Response &res) {
-  if (req.method == "GET" && handle_file_request(req, res)) { return true; }
-
-  if (req.method == "GET" || req.method == "HEAD") {
-    return dispatch_request(req, res, get_handlers_);
-  } else if (req.method == "POST") {
-    return dispatch_request(req, res, post_handlers_);
-  } else if (req.method == "PUT") {
-    return dispatch_request(req, res, put_handlers_);
-  } else if (req.method == "PATCH") {
-    return dispatch_request(req, res, patch_handlers_);
-  } else if (req.method == "DELETE") {
-    return dispatch_request(req, res, delete_handlers_);
-  } else if (req.method == "OPTIONS") {
-    return dispatch_request(req, res, options_handlers_);
+  switch (req.method_id) {
+  case MethodId::Get:
+    return handle_file_request(req, res) ||
+           dispatch_request(req, res, handlers(MethodId::Get));
+  case MethodId::Head:
+    // HEAD is answered by the GET handlers unless it has its own.
+    return handle_file_request(req, res) ||
+           dispatch_request(req, res, handlers(MethodId::Head)) ||
+           dispatch_request(req, res, handlers(MethodId::Get));
+  case MethodId::Unknown: {
+    auto it = custom_handlers_.find(req.method);
+    return it != custom_handlers_.end() &&
+           dispatch_request(req, res, it->second);
+  }
+  default: return dispatch_request(req, res, handlers(req.method_id));
   }
-  return false;
 }
 
 inline bool Server::dispatch_request(Request &req, Response &res,
                                      Handlers &handlers) {
-  for (const auto &x : handlers) {
-    const auto &pattern = x.first;
-    const auto &handler = x.second;
-
-    if (std::regex_match(req.path, req.matches, pattern)) {
-      handler(req, res);
-      return true;
-    }
+  auto handler = handlers.match(req);
+  if (handler) {
+    (*handler)(req, res);
+    return true;
   }
   return false;
 }
 
+inline void Server::dispatch_request_for_content_reader(
+    Stream &strm, Request &req, Response &res,
+    const HandlerWithContentReader &handler) {
+  auto read = false;
+  auto status = -1;
+
+  auto read_content = [&](const ContentReceiver &receiver) {
+    read = true;
+    return detail::read_content(strm, req, payload_max_length_, status,
+                                Progress(), receiver);
+  };
+
+  ContentReader reader(
+      [&](ContentReceiver receiver) { return !read && read_content(receiver); },
+      [&](MultipartContentHeader header, ContentReceiver receiver) {
+        if (read) { return false; }
+
+        std::string boundary;
+        auto valid = detail::parse_multipart_boundary(
+            req.get_header_value(HeaderId::ContentType), boundary);
+        detail::MultipartParser parser(boundary);
+
+        auto ret = read_content([&](const char *buf, size_t n) {
+          if (valid) { valid = parser.parse(buf, n, header, receiver); }
+        });
+        if (ret && !(valid && parser.is_done())) {
+          status = 400;
+          return false;
+        }
+        return ret;
+      });
+
+  handler(req, res, reader);
+
+  // Whatever the handler left unread still has to come off the connection.
+  if (!read) { read_content([](const char *, size_t) {}); }
+
+  if (status != -1) { res.status = status; }
+}
+
 inline bool
 Server::process_request(Stream &strm, bool last_connection,
                         bool &connection_close,
-                        std::function<void(Request &)> setup_request) {
+                        std::function<void(Request &)> setup_request,
+                        detail::Connection *conn) {
   const auto bufsiz = 2048;
   char buf[bufsiz];
 
   detail::stream_line_reader reader(strm, buf, bufsiz);
 
+  // The whole request line and header block has to arrive within the header
+  // deadline, which is what keeps slow clients from holding a worker.
+  detail::set_stage(conn, detail::Stage::Header);
+
   // Connection has been closed on client
   if (!reader.getline()) { return false; }
 
+  if (conn && reuse_request_storage_) {
+    auto &storage = detail::reuse_request_storage(*conn);
+    return handle_request(strm, reader, last_connection, connection_close,
+                          setup_request, conn, storage.req, storage.res);
+  }
+
   Request req;
   Response res;
+  return handle_request(strm, reader, last_connection, connection_close,
+                        setup_request, conn, req, res);
+}
 
+inline bool Server::handle_request(
+    Stream &strm, detail::stream_line_reader &reader, bool last_connection,
+    bool &connection_close,
+    const std::function<void(Request &)> &setup_request,
+    detail::Connection *conn, Request &req, Response &res) {
   res.version = "HTTP/1.1";
 
   // Check if the request URI doesn't exceed the limit
   if (reader.size() > CPPHTTPLIB_REQUEST_URI_MAX_LENGTH) {
     res.status = 414;
+    detail::set_stage(conn, detail::Stage::Write);
     write_response(strm, last_connection, req, res);
     return true;
   }
 
   // Request line and headers
+  std::string block;
+  auto &header_block =
+      conn && conn->storage ? conn->storage->header_block : block;
   if (!parse_request_line(reader.ptr(), req) ||
-      !detail::read_headers(strm, req.headers)) {
+      !detail::read_headers(strm, req.headers, header_block)) {
     res.status = 400;
+    detail::set_stage(conn, detail::Stage::Write);
     write_response(strm, last_connection, req, res);
     return true;
   }
 
-  if (req.get_header_value("Connection") == "close") {
+  if (detail::header_value_is(req.headers, HeaderId::Connection, "close")) {
     connection_close = true;
   }
 
   req.set_header("REMOTE_ADDR", strm.get_remote_addr().c_str());
 
   // Body
-  if (req.method == "POST" || req.method == "PUT" || req.method == "PATCH") {
-    if (!detail::read_content(
-        strm, req, payload_max_length_, res.status, Progress(),
-        [&](const char *buf, size_t n) { req.body.append(buf, n); })) {
+  auto method = req.method_id;
+  if (method == MethodId::Post || method == MethodId::Put ||
+      method == MethodId::Patch ||
+      (method == MethodId::Unknown &&
+       (detail::has_header(req.headers, HeaderId::ContentLength) ||
+        detail::is_chunked_transfer_encoding(req.headers)))) {
+    // Handlers that read the body themselves are routed before it is read.
+    auto handler = method == MethodId::Unknown
+                       ? nullptr
+                       : handlers_for_content_reader(method).match(req);
+    if (handler) {
+      if (setup_request) { setup_request(req); }
+      detail::set_stage(conn, detail::Stage::Body);
+      dispatch_request_for_content_reader(strm, req, res, *handler);
+      if (res.status == -1) { res.status = 200; }
+      detail::set_stage(conn, detail::Stage::Write);
       write_response(strm, last_connection, req, res);
       return true;
     }
 
-    const auto &content_type = req.get_header_value("Content-Type");
+    const auto &content_type = req.get_header_value(HeaderId::ContentType);
+    auto multipart = !content_type.find("multipart/form-data");
+
+    // Multipart bodies are split while they are read, so the parts are
+    // ready when the body is.
+    std::string boundary;
+    auto valid =
+        multipart && detail::parse_multipart_boundary(content_type, boundary);
+    detail::MultipartParser parser(boundary);
+    auto file = req.files.end();
+
+    detail::set_stage(conn, detail::Stage::Body);
+    if (!detail::read_content(
+            strm, req, payload_max_length_, res.status, Progress(),
+            [&](const char *buf, size_t n) {
+              req.body.append(buf, n);
+              if (valid) {
+                valid = parser.parse(
+                    buf, n,
+                    [&](const MultipartFile &x) {
+                      file = req.files.emplace(x.name, x);
+                    },
+                    [&](const char *, size_t n) { file->second.length += n; });
+              }
+            })) {
+      detail::set_stage(conn, detail::Stage::Write);
+      write_response(strm, last_connection, req, res);
+      return true;
+    }
 
     if (!content_type.find("application/x-www-form-urlencoded")) {
-      detail::parse_query_text(req.body, req.params);
-    } else if (!content_type.find("multipart/form-data")) {
-      std::string boundary;
-      if (!detail::parse_multipart_boundary(content_type, boundary) ||
-          !detail::parse_multipart_formdata(boundary, req.body, req.files)) {
-        res.status = 400;
-        write_response(strm, last_connection, req, res);
-        return true;
-      }
+      req.params.add_query_text(req.body.data(),
+                                req.body.data() + req.body.size());
+    } else if (multipart && !(valid && parser.is_done())) {
+      res.status = 400;
+      detail::set_stage(conn, detail::Stage::Write);
+      write_response(strm, last_connection, req, res);
+      return true;
     }
   }
 
@@ -1990,18 +5737,79 @@ Server::process_request(Stream &strm, bool last_connection,
     res.status = 404;
   }
 
+  detail::set_stage(conn, detail::Stage::Write);
   write_response(strm, last_connection, req, res);
   return true;
 }
 
 inline bool Server::is_valid() const { return true; }
 
-inline bool Server::read_and_close_socket(socket_t sock) {
-  return detail::read_and_close_socket(
-      sock, keep_alive_max_count_,
-      [this](Stream &strm, bool last_connection, bool &connection_close) {
-        return process_request(strm, last_connection, connection_close);
-      });
+inline bool Server::read_and_close_socket(socket_t sock,
+                                          detail::TimerWheel *wheel) {
+  detail::Connection conn;
+  conn.sock = sock;
+  conn.keep_alive_count = keep_alive_max_count_;
+  conn.wheel = wheel;
+  conn.timeouts = &timeouts_;
+
+  // The worker waits for the next request itself. Unlike a parked
+  // connection, nothing closes it on 'stop', so a zero keep-alive timeout
+  // falls back to the default instead of meaning no limit.
+  auto idle = timeouts_.keep_alive;
+  if (idle.is_zero()) {
+    idle = detail::Timeout{CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
+                           CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND};
+  }
+
+  auto ret = false;
+  while (detail::poll_read(sock, idle) > 0) {
+    ret = process_connection(conn);
+    if (!ret) { break; }
+    detail::set_stage(&conn, detail::Stage::None);
+  }
+
+  close_connection(conn);
+  return ret;
+}
+
+inline void Server::reject_connection(detail::Connection &conn) {
+  SocketStream strm(conn.sock);
+  Request req;
+  Response res;
+  res.version = "HTTP/1.1";
+  res.status = 503;
+  write_response(strm, true, req, res);
+  close_connection(conn);
+}
+
+inline bool Server::process_connection(detail::Connection &conn) {
+  SocketStream strm(conn.sock, detail::Timeout{CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                                               CPPHTTPLIB_READ_TIMEOUT_USECOND},
+                    &conn);
+  auto ret = true;
+
+  // Pipelined requests already in the read-ahead buffer are served in a row,
+  // and their responses leave in one write.
+  do {
+    auto last_connection = conn.keep_alive_count <= 1;
+    auto connection_close = false;
+
+    if (!process_request(strm, last_connection, connection_close, nullptr,
+                         &conn) ||
+        connection_close || last_connection) {
+      ret = false;
+      break;
+    }
+
+    conn.keep_alive_count--;
+  } while (conn.has_buffered_input());
+
+  return strm.flush() && ret;
+}
+
+inline void Server::close_connection(detail::Connection &conn) {
+  detail::cancel_deadline(conn);
+  detail::close_socket(conn.sock);
 }
 
 // HTTP client implementation
@@ -2021,7 +5829,8 @@ inline socket_t Client::create_client_socket() const {
         auto ret = connect(sock, ai.ai_addr, static_cast<int>(ai.ai_addrlen));
         if (ret < 0) {
           if (detail::is_connection_error() ||
-              !detail::wait_until_socket_is_ready(sock, timeout_sec_, 0)) {
+              !detail::wait_until_socket_is_ready(
+                  sock, detail::Timeout{timeout_sec_, 0})) {
             detail::close_socket(sock);
             return false;
           }
@@ -2069,7 +5878,7 @@ inline void Client::write_request(Stream &strm, Request &req) {
   bstrm.write_format("%s %s HTTP/1.1\r\n", req.method.c_str(), path.c_str());
 
   // Headers
-  if (!req.has_header("Host")) {
+  if (!req.has_header(HeaderId::Host)) {
     if (is_ssl()) {
       if (port_ == 443) {
         req.set_header("Host", host_.c_str());
@@ -2085,9 +5894,9 @@ inline void Client::write_request(Stream &strm, Request &req) {
     }
   }
 
-  if (!req.has_header("Accept")) { req.set_header("Accept", "*/*"); }
+  if (!req.has_header(HeaderId::Accept)) { req.set_header("Accept", "*/*"); }
 
-  if (!req.has_header("User-Agent")) {
+  if (!req.has_header(HeaderId::UserAgent)) {
     req.set_header("User-Agent", "cpp-httplib/0.2");
   }
 
@@ -2101,11 +5910,11 @@ inline void Client::write_request(Stream &strm, Request &req) {
       req.set_header("Content-Length", "0");
     }
   } else {
-    if (!req.has_header("Content-Type")) {
+    if (!req.has_header(HeaderId::ContentType)) {
       req.set_header("Content-Type", "text/plain");
     }
 
-    if (!req.has_header("Content-Length")) {
+    if (!req.has_header(HeaderId::ContentLength)) {
       auto length = std::to_string(req.body.size());
       req.set_header("Content-Length", length.c_str());
     }
@@ -2128,11 +5937,11 @@ inline bool Client::process_request(Stream &strm, Request &req, Response &res,
 
   // Receive response and headers
   if (!read_response_line(strm, res) ||
-      !detail::read_headers(strm, res.headers)) {
+      !detail::read_headers(strm, res.headers, true)) {
     return false;
   }
 
-  if (res.get_header_value("Connection") == "close" ||
+  if (detail::header_value_is(res.headers, HeaderId::Connection, "close") ||
       res.version == "HTTP/1.0") {
     connection_close = true;
   }
@@ -2356,34 +6165,59 @@ inline std::shared_ptr<Response> Client::Options(const char *path,
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 namespace detail {
 
-template <typename U, typename V, typename T>
-inline bool
-read_and_close_socket_ssl(socket_t sock, size_t keep_alive_max_count,
-                          // TODO: OpenSSL 1.0.2 occasionally crashes...
-                          // The upcoming 1.1.0 is going to be thread safe.
-                          SSL_CTX *ctx, std::mutex &ctx_mutex,
-                          U SSL_connect_or_accept, V setup, T callback) {
+// TODO: OpenSSL 1.0.2 occasionally crashes...
+// The upcoming 1.1.0 is going to be thread safe.
+inline SSL *ssl_new(socket_t sock, SSL_CTX *ctx, std::mutex &ctx_mutex) {
   SSL *ssl = nullptr;
   {
     std::lock_guard<std::mutex> guard(ctx_mutex);
     ssl = SSL_new(ctx);
   }
 
+  if (ssl) {
+    auto bio = BIO_new_socket(sock, BIO_NOCLOSE);
+    SSL_set_bio(ssl, bio, bio);
+  }
+
+  return ssl;
+}
+
+// Server handshake of a connection without a handshake deadline. The socket
+// is nonblocking meanwhile, so no wait lasts longer than `timeout`.
+inline bool ssl_accept(SSL *ssl, socket_t sock, const Timeout &timeout) {
+  set_nonblocking(sock, true);
+  int ret;
+  while ((ret = SSL_accept(ssl)) != 1) {
+    auto err = SSL_get_error(ssl, ret);
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) { break; }
+    short events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+    short revents;
+    if (poll_socket(sock, events, timeout, revents) <= 0) { break; }
+  }
+  set_nonblocking(sock, false);
+  return ret == 1;
+}
+
+inline void ssl_delete(std::mutex &ctx_mutex, SSL *ssl) {
+  SSL_shutdown(ssl);
+  std::lock_guard<std::mutex> guard(ctx_mutex);
+  SSL_free(ssl);
+}
+
+template <typename U, typename V, typename T>
+inline bool
+read_and_close_socket_ssl(socket_t sock, size_t keep_alive_max_count,
+                          SSL_CTX *ctx, std::mutex &ctx_mutex,
+                          U SSL_connect_or_accept, V setup, T callback) {
+  auto ssl = ssl_new(sock, ctx, ctx_mutex);
+
   if (!ssl) {
     close_socket(sock);
     return false;
   }
 
-  auto bio = BIO_new_socket(sock, BIO_NOCLOSE);
-  SSL_set_bio(ssl, bio, bio);
-
   if (!setup(ssl)) {
-    SSL_shutdown(ssl);
-    {
-      std::lock_guard<std::mutex> guard(ctx_mutex);
-      SSL_free(ssl);
-    }
-
+    ssl_delete(ctx_mutex, ssl);
     close_socket(sock);
     return false;
   }
@@ -2393,9 +6227,9 @@ read_and_close_socket_ssl(socket_t sock, size_t keep_alive_max_count,
   if (SSL_connect_or_accept(ssl) == 1) {
     if (keep_alive_max_count > 0) {
       auto count = keep_alive_max_count;
-      while (count > 0 &&
-             detail::select_read(sock, CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
-                                 CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND) > 0) {
+      const Timeout keep_alive_timeout{CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND,
+                                       CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND};
+      while (count > 0 && detail::poll_read(sock, keep_alive_timeout) > 0) {
         SSLSocketStream strm(sock, ssl);
         auto last_connection = count == 1;
         auto connection_close = false;
@@ -2412,12 +6246,7 @@ read_and_close_socket_ssl(socket_t sock, size_t keep_alive_max_count,
     }
   }
 
-  SSL_shutdown(ssl);
-  {
-    std::lock_guard<std::mutex> guard(ctx_mutex);
-    SSL_free(ssl);
-  }
-
+  ssl_delete(ctx_mutex, ssl);
   close_socket(sock);
 
   return ret;
@@ -2438,22 +6267,80 @@ static SSLInit sslinit_;
 } // namespace detail
 
 // SSL socket stream implementation
-inline SSLSocketStream::SSLSocketStream(socket_t sock, SSL *ssl)
-    : sock_(sock), ssl_(ssl) {}
+inline SSLSocketStream::SSLSocketStream(socket_t sock, SSL *ssl,
+                                        detail::Timeout read_timeout,
+                                        detail::Connection *conn)
+    : sock_(sock), ssl_(ssl), read_timeout_(read_timeout), conn_(conn),
+      read_buf_(conn ? &conn->read_buf : &own_read_buf_) {}
 
 inline SSLSocketStream::~SSLSocketStream() {}
 
 inline int SSLSocketStream::read(char *ptr, size_t size) {
-  if (SSL_pending(ssl_) > 0 ||
-      detail::select_read(sock_, CPPHTTPLIB_READ_TIMEOUT_SECOND,
-                          CPPHTTPLIB_READ_TIMEOUT_USECOND) > 0) {
-    return SSL_read(ssl_, ptr, size);
+  if (read_buf_->empty() && SSL_pending(ssl_) == 0 && !flush()) { return -1; }
+  return detail::read_buffered(
+      *read_buf_, ptr, size, [&](char *p, size_t n) { return read_ssl(p, n); });
+}
+
+inline int SSLSocketStream::read_line(char *ptr, size_t size) {
+  if (read_buf_->empty() && SSL_pending(ssl_) == 0 && !flush()) { return -1; }
+  return detail::read_line_buffered(
+      *read_buf_, ptr, size, [&](char *p, size_t n) { return read_ssl(p, n); });
+}
+
+inline int SSLSocketStream::consume(BufferConsumer consumer) {
+  if (read_buf_->empty() && SSL_pending(ssl_) == 0 && !flush()) { return -1; }
+  return detail::consume_buffered(
+      *read_buf_, consumer, [&](char *p, size_t n) { return read_ssl(p, n); });
+}
+
+inline int SSLSocketStream::write(const char *ptr, size_t size) {
+  if (conn_) {
+    return detail::write_buffered(
+        *conn_, ptr, size,
+        [&](const char *p, size_t n) { return write_ssl(p, n); });
+  }
+  return write_ssl(ptr, size);
+}
+
+inline ssize_t SSLSocketStream::writev(const IoVec *vec, size_t count) {
+  auto write = [&](const char *p, size_t n) { return write_ssl(p, n); };
+  auto total = static_cast<ssize_t>(detail::total_size(vec, count));
+
+  // Pieces are packed into the connection's output buffer, which is written
+  // out as it fills up or when the connection would block.
+  if (conn_) {
+    return detail::write_coalesced(conn_->write_buf, vec, count, write) ? total
+                                                                        : -1;
+  }
+
+  std::string buf;
+  return detail::write_coalesced(buf, vec, count, write) &&
+                 detail::write_all(buf.data(), buf.size(), write)
+             ? total
+             : -1;
+}
+
+inline bool SSLSocketStream::flush() {
+  return !conn_ || detail::flush_buffered(*conn_, [&](const char *p, size_t n) {
+    return write_ssl(p, n);
+  });
+}
+
+inline int SSLSocketStream::read_ssl(char *ptr, size_t size) {
+  auto supervised = conn_ && conn_->supervised;
+  if (supervised || SSL_pending(ssl_) > 0 ||
+      detail::poll_read(sock_, read_timeout_) > 0) {
+    auto n = SSL_read(ssl_, ptr, static_cast<int>(size));
+    if (n > 0 && conn_) { conn_->progress++; }
+    return n;
   }
   return -1;
 }
 
-inline int SSLSocketStream::write(const char *ptr, size_t size) {
-  return SSL_write(ssl_, ptr, size);
+inline int SSLSocketStream::write_ssl(const char *ptr, size_t size) {
+  auto n = SSL_write(ssl_, ptr, static_cast<int>(size));
+  if (n > 0 && conn_) { conn_->progress++; }
+  return n;
 }
 
 inline int SSLSocketStream::write(const char *ptr) {
@@ -2467,7 +6354,9 @@ inline std::string SSLSocketStream::get_remote_addr() const {
 // SSL HTTP server implementation
 inline SSLServer::SSLServer(const char *cert_path, const char *private_key_path,
                             const char *client_ca_cert_file_path,
-                            const char *client_ca_cert_dir_path) {
+                            const char *client_ca_cert_dir_path,
+                            ServerMode mode)
+    : Server(mode) {
   ctx_ = SSL_CTX_new(SSLv23_server_method());
 
   if (ctx_) {
@@ -2509,15 +6398,69 @@ inline SSLServer::~SSLServer() {
 
 inline bool SSLServer::is_valid() const { return ctx_; }
 
-inline bool SSLServer::read_and_close_socket(socket_t sock) {
-  return detail::read_and_close_socket_ssl(
-      sock, keep_alive_max_count_, ctx_, ctx_mutex_, SSL_accept,
-      [](SSL * /*ssl*/) { return true; },
-      [this](SSL *ssl, Stream &strm, bool last_connection,
-             bool &connection_close) {
-        return process_request(strm, last_connection, connection_close,
-                               [&](Request &req) { req.ssl = ssl; });
-      });
+inline void SSLServer::reject_connection(detail::Connection &conn) {
+  // Without an established session an error page would need a full TLS
+  // handshake on the rejecting thread.
+  if (conn.ssl) {
+    SSLSocketStream strm(conn.sock, conn.ssl);
+    Request req;
+    Response res;
+    res.version = "HTTP/1.1";
+    res.status = 503;
+    write_response(strm, true, req, res);
+  }
+  close_connection(conn);
+}
+
+inline bool SSLServer::process_connection(detail::Connection &conn) {
+  if (!conn.ssl) {
+    // The first readable event carries the ClientHello.
+    detail::set_stage(&conn, detail::Stage::Handshake);
+    conn.ssl = detail::ssl_new(conn.sock, ctx_, ctx_mutex_);
+    if (!conn.ssl) { return false; }
+    auto ok = conn.supervised
+                  ? SSL_accept(conn.ssl) == 1
+                  : detail::ssl_accept(conn.ssl, conn.sock,
+                                       detail::Timeout{
+                                           CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                                           CPPHTTPLIB_READ_TIMEOUT_USECOND});
+    if (!ok) { return false; }
+    if (SSL_pending(conn.ssl) == 0) {
+      detail::set_stage(&conn, detail::Stage::None);
+      return true;
+    }
+  }
+
+  SSLSocketStream strm(conn.sock, conn.ssl,
+                       detail::Timeout{CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                                       CPPHTTPLIB_READ_TIMEOUT_USECOND},
+                       &conn);
+  auto ret = true;
+
+  // Decrypted bytes left in the SSL buffer don't make the socket readable
+  // again, so consume them before going back to the event loop.
+  do {
+    auto last_connection = conn.keep_alive_count <= 1;
+    auto connection_close = false;
+
+    auto ssl = conn.ssl;
+    if (!process_request(strm, last_connection, connection_close,
+                         [&](Request &req) { req.ssl = ssl; }, &conn) ||
+        connection_close || last_connection) {
+      ret = false;
+      break;
+    }
+
+    conn.keep_alive_count--;
+  } while (conn.has_buffered_input() || SSL_pending(conn.ssl) > 0);
+
+  return strm.flush() && ret;
+}
+
+inline void SSLServer::close_connection(detail::Connection &conn) {
+  detail::cancel_deadline(conn);
+  if (conn.ssl) { detail::ssl_delete(ctx_mutex_, conn.ssl); }
+  Server::close_connection(conn);
 }
 
 // SSL HTTP client implementation
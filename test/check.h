@@ -0,0 +1,61 @@
+//
+//  check.h
+//
+//  Minimal assertion helpers shared by the test programs.
+//
+
+#ifndef CPPHTTPLIB_CHECK_H
+#define CPPHTTPLIB_CHECK_H
+
+#include <cstdio>
+#include <string>
+
+namespace check {
+
+inline int &failures() {
+  static int count = 0;
+  return count;
+}
+
+// Shows control characters and bytes outside ASCII as escapes.
+inline std::string quote(const std::string &s) {
+  std::string out = "\"";
+  for (auto c : s) {
+    auto u = static_cast<unsigned char>(c);
+    if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (u < 0x20 || u >= 0x7f) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\x%02x", u);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// Reports a mismatch for `input`. Only the first few are printed.
+inline void fail(const std::string &input, const char *what,
+                 const std::string &expected, const std::string &actual) {
+  if (failures()++ < 20) {
+    printf("FAIL %s: %s\n  expected %s\n  actual   %s\n", quote(input).c_str(),
+           what, quote(expected).c_str(), quote(actual).c_str());
+  }
+}
+
+inline void equal(const std::string &input, const char *what,
+                  const std::string &expected, const std::string &actual) {
+  if (expected != actual) { fail(input, what, expected, actual); }
+}
+
+inline int result(const char *name, size_t cases) {
+  printf("%s: %zu cases, %d failures\n", name, cases, failures());
+  return failures() ? 1 : 0;
+}
+
+} // namespace check
+
+#endif // CPPHTTPLIB_CHECK_H
@@ -0,0 +1,87 @@
+//
+//  headers.cpp
+//
+//  Checks detail::parse_headers in both of its modes: strict, as the server
+//  reads requests, where any malformed line rejects the whole block; and
+//  lenient, as the client reads responses, where such lines are skipped and
+//  the well-formed fields around them kept.
+//
+
+#include "check.h"
+#include <httplib.h>
+
+using namespace httplib;
+
+namespace {
+
+struct Case {
+  std::string block;
+  bool strict_ok;
+  bool lenient_ok;
+  // Fields the lenient parse keeps, as "name=value;" pairs.
+  const char *lenient_fields;
+};
+
+const char kNulValue[] = "A: 1\0"
+                         "2\r\nC: 2\r\n\r\n";
+
+const Case cases[] = {
+    {"A: 1\r\nB: 2\r\n\r\n", true, true, "A=1;B=2;"},
+    {"A: 1\nB:2 \n\n", true, true, "A=1;B=2;"},
+    {"\r\n", true, true, ""},
+    {"A:\r\n\r\n", true, true, "A=;"},
+    {"A: x:y\r\n\r\n", true, true, "A=x:y;"},
+    // Whitespace before the colon
+    {"A : 1\r\nB: 2\r\n\r\n", false, true, "A=1;B=2;"},
+    {"A\t: 1\r\n\r\n", false, true, "A=1;"},
+    // obs-fold continuation lines
+    {"A: 1\r\n  more\r\nB: 2\r\n\r\n", false, true, "A=1;B=2;"},
+    {"A: 1\r\n\tmore: x\r\n\r\n", false, true, "A=1;"},
+    // Names that aren't tokens, missing colons, empty names
+    {"A B: 1\r\nC: 2\r\n\r\n", false, true, "C=2;"},
+    {"junk\r\nC: 2\r\n\r\n", false, true, "C=2;"},
+    {": 1\r\nC: 2\r\n\r\n", false, true, "C=2;"},
+    // Bare CR and NUL in values
+    {"A: 1\r2\r\nC: 2\r\n\r\n", false, true, "C=2;"},
+    {std::string(kNulValue, sizeof(kNulValue) - 1), false, true, "C=2;"},
+    // Unterminated blocks
+    {"A: 1\r\n", false, false, ""},
+    {"A: 1", false, false, ""},
+    {"junk", false, false, ""},
+};
+
+std::string fields(const Headers &headers) {
+  std::string s;
+  for (const auto &x : headers) {
+    s += x.first + "=" + x.second + ";";
+  }
+  return s;
+}
+
+} // namespace
+
+int main() {
+  size_t count = 0;
+  for (const auto &c : cases) {
+    const auto &block = c.block;
+    auto b = block.data();
+    auto e = b + block.size();
+
+    Headers strict;
+    auto ok = detail::parse_headers(b, e, strict);
+    check::equal(block, "strict", c.strict_ok ? "ok" : "rejected",
+                 ok ? "ok" : "rejected");
+
+    Headers lenient;
+    ok = detail::parse_headers(b, e, lenient, true);
+    check::equal(block, "lenient", c.lenient_ok ? "ok" : "rejected",
+                 ok ? "ok" : "rejected");
+    if (ok) {
+      check::equal(block, "lenient fields", c.lenient_fields,
+                   fields(lenient));
+    }
+    count++;
+  }
+
+  return check::result("headers", count);
+}
@@ -0,0 +1,142 @@
+//
+//  reference.h
+//
+//  The code the hand-written parsers and codecs replaced, kept as it was so
+//  the tests can compare against it and the benchmarks can time it.
+//
+
+#ifndef CPPHTTPLIB_REFERENCE_H
+#define CPPHTTPLIB_REFERENCE_H
+
+#include <httplib.h>
+#include <regex>
+#include <string>
+
+namespace reference {
+
+// Request line
+
+struct RequestLine {
+  std::string method;
+  std::string target;
+  std::string path;
+  std::string query;
+  std::string version;
+};
+
+// The regex Server::parse_request_line matched before. `s` is the line
+// with its CRLF.
+inline bool parse_request_line(const char *s, RequestLine &line) {
+  static std::regex re("(GET|HEAD|POST|PUT|PATCH|DELETE|OPTIONS) "
+                       "(([^?]+)(?:\\?(.+?))?) (HTTP/1\\.[01])\r\n");
+
+  std::cmatch m;
+  if (!std::regex_match(s, m, re)) { return false; }
+  line.method = std::string(m[1]);
+  line.target = std::string(m[2]);
+  line.path = std::string(m[3]);
+  line.query = std::string(m[4]);
+  line.version = std::string(m[5]);
+  return true;
+}
+
+// URL codec
+
+inline bool is_hex(char c, int &v) {
+  if (0x20 <= c && isdigit(c)) {
+    v = c - '0';
+    return true;
+  } else if ('A' <= c && c <= 'F') {
+    v = c - 'A' + 10;
+    return true;
+  } else if ('a' <= c && c <= 'f') {
+    v = c - 'a' + 10;
+    return true;
+  }
+  return false;
+}
+
+inline bool from_hex_to_i(const std::string &s, size_t i, size_t cnt,
+                          int &val) {
+  if (i >= s.size()) { return false; }
+
+  val = 0;
+  for (; cnt; i++, cnt--) {
+    if (!s[i]) { return false; }
+    int v = 0;
+    if (is_hex(s[i], v)) {
+      val = val * 16 + v;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline std::string encode_url(const std::string &s) {
+  std::string result;
+
+  for (auto i = 0; s[i]; i++) {
+    switch (s[i]) {
+    case ' ': result += "%20"; break;
+    case '+': result += "%2B"; break;
+    case '\r': result += "%0D"; break;
+    case '\n': result += "%0A"; break;
+    case '\'': result += "%27"; break;
+    case ',': result += "%2C"; break;
+    case ':': result += "%3A"; break;
+    case ';': result += "%3B"; break;
+    default:
+      auto c = static_cast<uint8_t>(s[i]);
+      if (c >= 0x80) {
+        result += '%';
+        char hex[4];
+        size_t len = snprintf(hex, sizeof(hex) - 1, "%02X", c);
+        result.append(hex, len);
+      } else {
+        result += s[i];
+      }
+      break;
+    }
+  }
+
+  return result;
+}
+
+inline std::string decode_url(const std::string &s) {
+  std::string result;
+
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '%' && i + 1 < s.size()) {
+      if (s[i + 1] == 'u') {
+        int val = 0;
+        if (from_hex_to_i(s, i + 2, 4, val)) {
+          char buff[4];
+          size_t len = httplib::detail::to_utf8(val, buff);
+          if (len > 0) { result.append(buff, len); }
+          i += 5;
+        } else {
+          result += s[i];
+        }
+      } else {
+        int val = 0;
+        if (from_hex_to_i(s, i + 1, 2, val)) {
+          result += static_cast<char>(val);
+          i += 2;
+        } else {
+          result += s[i];
+        }
+      }
+    } else if (s[i] == '+') {
+      result += ' ';
+    } else {
+      result += s[i];
+    }
+  }
+
+  return result;
+}
+
+} // namespace reference
+
+#endif // CPPHTTPLIB_REFERENCE_H
@@ -0,0 +1,143 @@
+//
+//  request_line.cpp
+//
+//  Checks detail::parse_request_line against the regex it replaced, on edge
+//  cases and on lines generated from fragments. Both must accept the same
+//  lines and split them the same way. The parser also takes methods other
+//  than the seven the regex knows, as MethodId::Unknown; the server rejects
+//  those unless a route was added for them.
+//
+
+#include "check.h"
+#include "reference.h"
+#include <httplib.h>
+#include <random>
+
+using namespace httplib;
+
+namespace {
+
+std::string str(const std::pair<const char *, const char *> &r) {
+  return std::string(r.first, r.second);
+}
+
+void compare(const std::string &s) {
+  reference::RequestLine expected;
+  auto expected_ok = reference::parse_request_line(s.c_str(), expected);
+
+  detail::RequestLine line;
+  auto ok = detail::parse_request_line(s.data(), s.data() + s.size(), line);
+  auto known = ok && line.method_id != MethodId::Unknown;
+
+  if (expected_ok != known) {
+    check::fail(s, "accepted", expected_ok ? "yes" : "no",
+                ok ? (known ? "yes" : "unknown method") : "no");
+    return;
+  }
+  if (!expected_ok) { return; }
+
+  check::equal(s, "method", expected.method, str(line.method));
+  check::equal(s, "target", expected.target, str(line.target));
+  check::equal(s, "path", expected.path, str(line.path));
+  check::equal(s, "query", expected.query, str(line.query));
+  check::equal(s, "version", expected.version, str(line.version));
+}
+
+const char *edge_cases[] = {
+    "GET / HTTP/1.1\r\n",
+    "GET / HTTP/1.0\r\n",
+    "OPTIONS * HTTP/1.1\r\n",
+    // Absolute and authority forms
+    "GET http://example.com/a/b?c=d HTTP/1.1\r\n",
+    "GET http://example.com:8080 HTTP/1.1\r\n",
+    "CONNECT example.com:443 HTTP/1.1\r\n",
+    // Bare and invalid percent escapes stay in the target
+    "GET /% HTTP/1.1\r\n",
+    "GET /a%zz HTTP/1.1\r\n",
+    "GET /%?% HTTP/1.1\r\n",
+    "GET /a?%25 HTTP/1.1\r\n",
+    // Empty query, empty path, several question marks
+    "GET /a? HTTP/1.1\r\n",
+    "GET ? HTTP/1.1\r\n",
+    "GET ?a HTTP/1.1\r\n",
+    "GET /a?? HTTP/1.1\r\n",
+    "GET /a?b?c HTTP/1.1\r\n",
+    "GET /a?b=1&c= HTTP/1.1\r\n",
+    // Missing or malformed version
+    "GET /\r\n",
+    "GET / \r\n",
+    "GET / HTTP/1.1",
+    "GET / HTTP/1.1\n",
+    "GET / HTTP/1.2\r\n",
+    "GET / HTTP/2\r\n",
+    "GET / http/1.1\r\n",
+    "GET /HTTP/1.1\r\n",
+    // Trailing and extra whitespace
+    "GET / HTTP/1.1 \r\n",
+    "GET / HTTP/1.1\t\r\n",
+    "GET / HTTP/1.1\r\n\r\n",
+    "GET  / HTTP/1.1\r\n",
+    "GET /  HTTP/1.1\r\n",
+    "GET / a HTTP/1.1\r\n",
+    " GET / HTTP/1.1\r\n",
+    "GET\t/ HTTP/1.1\r\n",
+    // Methods
+    "get / HTTP/1.1\r\n",
+    "PROPFIND / HTTP/1.1\r\n",
+    "GETS / HTTP/1.1\r\n",
+    "GE / HTTP/1.1\r\n",
+    "G / HTTP/1.1\r\n",
+    " / HTTP/1.1\r\n",
+    // Line breaks inside the target
+    "GET /a\rb HTTP/1.1\r\n",
+    "GET /a\nb HTTP/1.1\r\n",
+    "GET /a?b\rc HTTP/1.1\r\n",
+    "GET /a?b\nc HTTP/1.1\r\n",
+    "",
+    "\r\n",
+};
+
+} // namespace
+
+int main() {
+  size_t cases = 0;
+  for (auto s : edge_cases) {
+    compare(s);
+    cases++;
+  }
+
+  static const char *methods[] = {"GET",     "HEAD",   "POST", "PUT",
+                                  "PATCH",   "DELETE", "OPTIONS", "get",
+                                  "PROPFIND", "GE",    "",     "G\tET"};
+  static const char *separators[] = {" ", " ", " ", "  ", "\t", ""};
+  static const char *pieces[] = {"/",  "a",  "b",  "?",  "%",  "%zz",
+                                 "%2F", "=", "&",  " ",  "#",  "http://h",
+                                 "\r", "\n", "+",  "HTTP/1.1"};
+  static const char *versions[] = {"HTTP/1.1", "HTTP/1.0", "HTTP/1.1",
+                                   "HTTP/1.2", "HTTP/1.",  "http/1.1", ""};
+  static const char *endings[] = {"\r\n", "\r\n", "\r\n", "\n",
+                                  " \r\n", "\r\n\r\n", ""};
+
+  std::mt19937 rng(2019);
+  auto pick = [&](const char *const *list, size_t n) {
+    return list[rng() % n];
+  };
+#define PICK(list) pick(list, sizeof(list) / sizeof(list[0]))
+
+  for (int i = 0; i < 200000; i++) {
+    std::string s = PICK(methods);
+    s += PICK(separators);
+    auto n = rng() % 6;
+    for (size_t j = 0; j < n; j++) {
+      s += PICK(pieces);
+    }
+    s += PICK(separators);
+    s += PICK(versions);
+    s += PICK(endings);
+    compare(s);
+    cases++;
+  }
+#undef PICK
+
+  return check::result("request_line", cases);
+}